@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm> // for std::max
+#include <cstdlib> // for std::abort
+#include <cstring>
+#include "minIni/minGlue.h" // for the u8-u64 types
+#include "config.hpp"
+#include "results.hpp"
+#include "history.hpp"
+#include "pattern_db.hpp"
+#include "scanner.hpp"
+
+// the sysmod's memory: every runtime buffer is carved from one static block, so the footprint
+// is known at build time. allocations are freed a phase at a time with ArenaScope, the pattern
+// database is the only one kept. shared with tools/src/arena-check.cpp, which checks it on a pc.
+
+#if defined SYS_PATCH_STATIC_ARENA
+// nothing in the sysmod allocates, so the newlib heap is removed and its memory goes to the read buffer
+constexpr u64 INNER_HEAP_SIZE = 0x0;
+constexpr u64 READ_BUFFER_SIZE = 0x2000; // size of the arena buffer which memory is read into
+#else
+constexpr u64 INNER_HEAP_SIZE = 0x1000; // Size of the inner heap (adjust as necessary).
+constexpr u64 READ_BUFFER_SIZE = 0x1000; // size of the arena buffer which memory is read into
+#endif
+constexpr u64 INI_BUFFER_SIZE = 0x1000; // size of the arena buffer which the config is assembled in
+constexpr u64 PATTERN_DB_MAX_SIZE = PATTERN_DB_MAX_FILE_SIZE; // most the arena can hold of the pattern database
+constexpr u32 MAX_TITLES = 16; // most titles that can be patched, from either the built-in table or the pattern database
+constexpr u32 PATTERN_DB_MAX_PATTERNS = 64; // most patterns the pattern database can have active at once
+
+static_assert(PATTERN_DB_MAX_PATTERNS <= SCAN_MAX_PATTERNS);
+
+// log.ini and timing.ini are assembled in LOG_BUFFER_SIZE, which fits them with MAX_TITLES titles
+// and PATTERN_DB_MAX_PATTERNS patterns. a line is at most a pattern name (or a title name and a
+// suffix, or a fixed key), = and a result (or a number), and the line end.
+constexpr u64 LOG_LINE_MAX_SIZE = 0x40;
+constexpr u64 LOG_FIXED_LINES = 32; // [stats] / [timing] and the keys that aren't per title
+// a section per title with a line per pattern, then [scan] with up to 4 lines per title
+constexpr u64 LOG_MAX_LINES = MAX_TITLES + PATTERN_DB_MAX_PATTERNS + 1 + MAX_TITLES * 4 + LOG_FIXED_LINES;
+// a time per title, then [benchmark] with 4 lines per title and 3 each for find and total
+constexpr u64 TIMING_MAX_LINES = MAX_TITLES + 1 + MAX_TITLES * 4 + 2 * 3 + LOG_FIXED_LINES;
+constexpr u64 LOG_BUFFER_SIZE = LOG_LINE_MAX_SIZE * std::max(LOG_MAX_LINES, TIMING_MAX_LINES);
+
+static_assert(sizeof(PatternDbPattern::name) + 1 + sizeof("Failed (svcWriteDebugProcessMemory)") + 2 <= LOG_LINE_MAX_SIZE,
+    "a pattern's result doesn't fit in a log line");
+
+// the phases are: config, restoring results (rescan), scanning (inside a benchmark, which keeps
+// the results and its samples) and logging (which reads the history).
+// the pattern database is loaded before and kept until exit.
+constexpr u64 BENCHMARK_SAMPLE_COUNT = (2 + MAX_TITLES) * BENCHMARK_MAX_RUNS; // find, total then the titles
+constexpr u64 BENCHMARK_SAMPLES_SIZE = sizeof(PatternResult) * PATTERN_DB_MAX_PATTERNS + sizeof(u64) * BENCHMARK_SAMPLE_COUNT;
+constexpr u64 RESULTS_MAX_SIZE = sizeof(ResultsHeader) + sizeof(ResultsEntry) * PATTERN_DB_MAX_PATTERNS;
+constexpr u64 FILE_BUFFER_SIZE = std::max(HISTORY_FILE_SIZE, RESULTS_MAX_SIZE); // results.bin, then history.bin
+constexpr u64 ARENA_PHASE_SIZE = std::max(LOG_BUFFER_SIZE + FILE_BUFFER_SIZE, BENCHMARK_SAMPLES_SIZE + sizeof(Scanner) + READ_BUFFER_SIZE + WINDOW_BUFFER_SIZE);
+constexpr u64 ARENA_SIZE = PATTERN_DB_MAX_SIZE + ARENA_PHASE_SIZE + 0x40; // + alignment
+
+struct Arena {
+    u8* data;
+    u64 size;
+    u64 used;
+    u64 peak; // most used at once, logged
+
+    // returns zeroed memory, like the static buffers it replaces.
+    // running out is a bug (the sizes are fixed), so it's fatal.
+    template<typename T>
+    auto alloc(u64 count = 1) -> T* {
+        const auto start = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (start + sizeof(T) * count > size) {
+            #if defined __SWITCH__
+            fatalThrow(MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+            #else
+            std::abort();
+            #endif
+        }
+        used = start + sizeof(T) * count;
+        peak = std::max(peak, used);
+        std::memset(data + start, 0, sizeof(T) * count);
+        return (T*)(data + start);
+    }
+};
+
+// frees everything allocated from the arena during its lifetime
+struct ArenaScope {
+    explicit ArenaScope(Arena& arena) : arena{arena}, mark{arena.used} {}
+    ~ArenaScope() { arena.used = mark; }
+    ArenaScope(const ArenaScope&) = delete;
+    auto operator=(const ArenaScope&) -> ArenaScope& = delete;
+
+    // keeps what was allocated in the scope up to end, the rest is still freed
+    void keep(const void* end) {
+        mark = (const u8*)end - arena.data;
+    }
+
+    Arena& arena;
+    u64 mark;
+};
+
+// the scanner and the buffers a scan reads into, READ_BUFFER_SIZE is returned in read_buffer
+inline auto arena_alloc_scan(Arena& arena, u8** read_buffer) -> Scanner& {
+    auto& scanner = *arena.alloc<Scanner>();
+    *read_buffer = arena.alloc<u8>(READ_BUFFER_SIZE);
+    scanner.window_buffer = arena.alloc<u8>(WINDOW_BUFFER_SIZE);
+    return scanner;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdlib> // for std::strtoul
+#include <iterator> // for std::size
+#include <utility> // std::unreachable
+#include <strings.h> // for strcasecmp
+#include "minIni/minIni.h"
+
+// shared by the sysmod and the overlay, so that both agree on where the
+// files are and what the options are called.
+constexpr auto CONFIG_PATH = "/config/sys-patch/config.ini";
+constexpr auto LOG_PATH = "/config/sys-patch/log.ini";
+// what changes every boot (timings), kept out of the log so that it's only rewritten when the results change
+constexpr auto TIMING_PATH = "/config/sys-patch/timing.ini";
+// created by the overlay to ask the sysmod to only retry what wasn't patched
+constexpr auto RESCAN_PATH = "/config/sys-patch/rescan";
+// created by the overlay to ask the sysmod to benchmark the scan before patching
+constexpr auto BENCHMARK_PATH = "/config/sys-patch/benchmark";
+constexpr u32 BENCHMARK_DEFAULT_RUNS = 10; // when asked by the overlay and benchmark_runs isn't set
+constexpr u32 BENCHMARK_MAX_RUNS = 32;
+constexpr u64 SYSPATCH_TITLE_ID = 0x420000000000000B;
+
+struct Config {
+    bool patch_sysmmc{true}; // patch sysmmc
+    bool patch_emummc{true}; // patch emummc
+    bool enable_logging{true}; // output LOG_PATH
+    bool version_skip{true}; // skip out of date patterns
+    bool match_all{false}; // scan all of each title and don't patch ambiguous patterns
+    u32 title_budget_ms{0}; // longest a title is scanned for, 0 for no limit
+    u32 scan_budget_ms{0}; // longest all of the titles are scanned for, 0 for no limit
+    u32 benchmark_runs{0}; // scans without patching this many times on every boot, timing each one
+};
+
+struct ConfigOption {
+    const char* section;
+    const char* key;
+    bool Config::* value;
+    u32 Config::* number{}; // set instead of value for numeric options
+};
+
+// the defaults are taken from the member initialisers of Config
+constexpr ConfigOption CONFIG_OPTIONS[] = {
+    { "options", "patch_sysmmc", &Config::patch_sysmmc },
+    { "options", "patch_emummc", &Config::patch_emummc },
+    { "options", "enable_logging", &Config::enable_logging },
+    { "options", "version_skip", &Config::version_skip },
+    { "options", "match_all", &Config::match_all },
+    { "options", "title_budget_ms", nullptr, &Config::title_budget_ms },
+    { "options", "scan_budget_ms", nullptr, &Config::scan_budget_ms },
+    { "options", "benchmark_runs", nullptr, &Config::benchmark_runs },
+};
+
+// eg, config_option(&Config::version_skip).key -> "version_skip"
+constexpr auto config_option(bool Config::* value) -> const ConfigOption& {
+    for (const auto& option : CONFIG_OPTIONS) {
+        if (option.value == value) {
+            return option;
+        }
+    }
+    std::unreachable();
+}
+
+constexpr u32 CONFIG_ALL_OPTIONS = (1U << std::size(CONFIG_OPTIONS)) - 1;
+static_assert(std::size(CONFIG_OPTIONS) <= 32, "option masks are a u32");
+
+// reads every option in a single pass over the file.
+// options that are not in the file keep their default value.
+// returns a mask of the options that were missing (bit n = CONFIG_OPTIONS[n]).
+inline auto config_load(Config& config, const char* path = CONFIG_PATH) -> u32 {
+    struct CallbackUser {
+        Config* config;
+        u32 missing;
+    } user{&config, CONFIG_ALL_OPTIONS};
+
+    ini_browse([](const mTCHAR* Section, const mTCHAR* Key, const mTCHAR* Value, void* UserData) {
+        auto user = (CallbackUser*)UserData;
+
+        for (u32 i = 0; i < std::size(CONFIG_OPTIONS); i++) {
+            const auto& option = CONFIG_OPTIONS[i];
+            if (strcasecmp(option.section, Section) || strcasecmp(option.key, Key)) {
+                continue;
+            }
+
+            // numbers are decimal, anything that isn't keeps the default
+            if (option.number) {
+                if (Value[0] >= '0' && Value[0] <= '9') {
+                    user->config->*option.number = std::strtoul(Value, nullptr, 10);
+                    user->missing &= ~(1U << i);
+                }
+                break;
+            }
+
+            // same rules as ini_getbool(), anything else keeps the default
+            switch (Value[0]) {
+                case 'Y': case 'y': case 'T': case 't': case '1':
+                    user->config->*option.value = true;
+                    user->missing &= ~(1U << i);
+                    break;
+                case 'N': case 'n': case 'F': case 'f': case '0':
+                    user->config->*option.value = false;
+                    user->missing &= ~(1U << i);
+                    break;
+            }
+            break;
+        }
+
+        return 1;
+    }, &user, path);
+
+    return user.missing;
+}
+
+// writes the value of every option in mask (bit n = CONFIG_OPTIONS[n]) with one file write.
+// options that already have that value don't cause a write.
+inline auto config_write(const Config& config, u32 mask, char* buffer, int buffer_size, const char* path = CONFIG_PATH) -> bool {
+    if (!mask) {
+        return true;
+    }
+
+    INI_BATCH batch{};
+    if (!ini_batch_begin(&batch, buffer, buffer_size, false, path)) {
+        return false;
+    }
+
+    for (u32 i = 0; i < std::size(CONFIG_OPTIONS); i++) {
+        if (mask & (1U << i)) {
+            const auto& option = CONFIG_OPTIONS[i];
+            ini_batch_putl(&batch, option.section, option.key, option.number ? config.*option.number : config.*option.value);
+        }
+    }
+
+    return ini_batch_commit(&batch);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef> // for offsetof
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+// a record of every boot, kept in a fixed size ring so that trends can be seen
+// across fw and sys-patch updates. unlike the log, it's never rewritten: each
+// boot writes its record over the oldest one, with a single write.
+//
+// layout: HistoryHeader, then header.record_count * HistoryRecord.
+// record n is at header_size + n * record_size, the newest has the highest sequence.
+constexpr auto HISTORY_PATH = "/config/sys-patch/history.bin";
+constexpr u32 HISTORY_MAGIC = 0x48505953; // "SYPH"
+constexpr u16 HISTORY_VERSION = 1;
+constexpr u16 HISTORY_RECORD_COUNT = 64;
+
+enum HistoryFlag : u8 {
+    HistoryFlag_Emummc = 1 << 0,
+    HistoryFlag_Rescan = 1 << 1,
+    HistoryFlag_PatternDb = 1 << 2, // patterns came from the pattern database
+    HistoryFlag_MatchAll = 1 << 3,
+    HistoryFlag_TimedOut = 1 << 4, // a title ran out of scan budget
+    HistoryFlag_Benchmark = 1 << 5, // the scan ran before (without patching), so it was warm
+};
+
+// the startup steps, in the order they're stored in HistoryRecord::init_us
+enum HistoryInit : u8 {
+    HistoryInit_Sm,
+    HistoryInit_Fs,
+    HistoryInit_Setsys,
+    HistoryInit_Spl,
+    HistoryInit_Config,
+    HistoryInit_PatternDb,
+    HistoryInit_Count,
+};
+
+constexpr const char* HISTORY_INIT_NAMES[] = { "sm", "fs", "setsys", "spl", "config", "pattern_db" };
+
+struct HistoryHeader {
+    u32 magic; // HISTORY_MAGIC
+    u16 version; // HISTORY_VERSION
+    u16 header_size; // sizeof(HistoryHeader)
+    u16 record_size; // sizeof(HistoryRecord)
+    u16 record_count; // HISTORY_RECORD_COUNT
+    u8 reserved[4];
+};
+
+struct HistoryRecord {
+    u64 sequence; // 1 for the first boot recorded, 0 if the slot hasn't been written
+    u64 timestamp; // posix time, 0 if unknown
+    u64 ams_hash;
+    u64 bytes_read; // memory scanned, of every title
+    u64 patched; // bit n: pattern n (in the order of the log) was patched, by sys-patch or already
+    u64 unpatched; // bit n: pattern n wasn't found, was ambiguous, failed to write or timed out
+    u32 fw_version; // MAKEHOSVERSION format
+    u32 ams_version;
+    u32 patch_time_us;
+    u32 start_to_scan_us;
+    u32 start_to_first_patch_us; // 0 if nothing was patched by sys-patch
+    u32 init_us[HistoryInit_Count];
+    u32 reads; // svcReadDebugProcessMemory calls
+    u32 queries; // svcQueryDebugProcessMemory calls
+    u16 regions; // code regions scanned
+    u8 pattern_count;
+    u8 flags; // HistoryFlag
+    char syspatch_version[24]; // VERSION_WITH_HASH of the sysmod that wrote the record
+};
+
+static_assert(sizeof(HistoryHeader) == 16);
+static_assert(sizeof(HistoryRecord) == 128 && offsetof(HistoryRecord, syspatch_version) == 104);
+
+constexpr u64 HISTORY_FILE_SIZE = sizeof(HistoryHeader) + sizeof(HistoryRecord) * HISTORY_RECORD_COUNT;
+
+// returns the header if data holds a complete history file, nullptr otherwise
+inline auto history_validate(const void* data, u64 size) -> const HistoryHeader* {
+    const auto header = (const HistoryHeader*)data;
+    if (size < sizeof(HistoryHeader) || header->magic != HISTORY_MAGIC || header->version != HISTORY_VERSION) {
+        return nullptr;
+    }
+    if (header->header_size != sizeof(HistoryHeader) || header->record_size != sizeof(HistoryRecord) || !header->record_count) {
+        return nullptr;
+    }
+    if (size < header->header_size + (u64)header->record_size * header->record_count) {
+        return nullptr;
+    }
+    return header;
+}
+
+inline auto history_record(const HistoryHeader* header, u32 index) -> const HistoryRecord* {
+    return (const HistoryRecord*)((const u8*)header + header->header_size + (u64)header->record_size * index);
+}
+
+// the highest sequence in the file, 0 if it's empty
+inline auto history_last_sequence(const HistoryHeader* header) -> u64 {
+    u64 sequence{};
+    for (u32 i = 0; i < header->record_count; i++) {
+        if (history_record(header, i)->sequence > sequence) {
+            sequence = history_record(header, i)->sequence;
+        }
+    }
+    return sequence;
+}
+
+// where the record with this sequence goes, over the oldest one
+inline auto history_record_offset(const HistoryHeader* header, u64 sequence) -> u64 {
+    return header->header_size + (u64)header->record_size * ((sequence - 1) % header->record_count);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <iterator> // for std::size
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+// the checks / patches applied to the instruction a pattern points at, referenced
+// by id from the pattern tables and the pattern database.
+// the names are what the pattern database text source uses.
+enum class CondId : u8 { SUBS, BL, TBZ, CBZ, MOV, MOV2, BNE, COUNT };
+enum class PatchId : u8 { RET0, NOP, SUBS, B, MOV0, COUNT };
+enum class AppliedId : u8 { RET0, NOP, SUBS, B, MOV0, COUNT };
+
+constexpr const char* COND_NAMES[] = { "subs", "bl", "tbz", "cbz", "mov", "mov2", "bne" };
+constexpr const char* PATCH_NAMES[] = { "ret0", "nop", "subs", "b", "mov0" };
+constexpr const char* APPLIED_NAMES[] = { "ret0", "nop", "subs", "b", "mov0" };
+
+static_assert(std::size(COND_NAMES) == (u32)CondId::COUNT);
+static_assert(std::size(PATCH_NAMES) == (u32)PatchId::COUNT);
+static_assert(std::size(APPLIED_NAMES) == (u32)AppliedId::COUNT);
+
+// an instruction matches if (inst & mask) == value for either term.
+// single term checks repeat the term, so that the check never branches.
+struct InstCond {
+    u32 mask[2];
+    u32 value[2];
+
+    constexpr auto matches(u32 inst) const -> bool {
+        return ((inst & mask[0]) == value[0]) | ((inst & mask[1]) == value[1]);
+    }
+};
+
+constexpr auto inst_cond(u32 mask, u32 value) -> InstCond {
+    return { { mask, mask }, { value, value } };
+}
+
+constexpr auto inst_cond(u32 mask0, u32 value0, u32 mask1, u32 value1) -> InstCond {
+    return { { mask0, mask1 }, { value0, value1 } };
+}
+
+// the patch is value | ((inst >> field_shift) & field_mask), of which size bytes are written
+struct InstPatch {
+    u32 value;
+    u32 field_mask;
+    u8 field_shift;
+    u8 size;
+
+    constexpr auto apply(u32 inst) const -> u32 {
+        return value | ((inst >> field_shift) & field_mask);
+    }
+};
+
+// encodings, stored little endian
+constexpr u32 INST_RET0 = 0x2A1F03E0; // mov w0, wzr
+constexpr u32 INST_NOP = 0xD503201F; // nop
+constexpr u32 INST_MOV0 = 0xAA1F03E0; // mov x0, xzr
+
+// subs w/x, #0xA (used on Atmosphère-NX 0.11.0 - 0.12.0) and
+// subs w/x, reg, x1 (used on Atmosphère-NX 0.13.0 and later)
+constexpr u32 INST_SUBI_MASK = 0xFF3FFC00;
+constexpr u32 INST_SUBR_MASK = 0xFF3F0000;
+
+// the version dependent conds are set by inst_init()
+inline constinit InstCond INST_CONDS[] = {
+    inst_cond(INST_SUBI_MASK, 0x71002800, INST_SUBR_MASK, 0x6B010000), // subs
+    inst_cond(0xFC000000, 0x94000000), // bl
+    inst_cond(0x7F000000, 0x36000000), // tbz
+    inst_cond(0x7F000000, 0x34000000), // cbz
+    inst_cond(0x7F000000, 0x52000000), // mov
+    inst_cond(0xFF000000, 0x2A000000), // mov2
+    inst_cond(0xFF000000, 0x54000000, 0x00000010, 0x00000000), // bne
+};
+
+constexpr InstPatch INST_PATCHES[] = {
+    { INST_RET0, 0, 0, 4 }, // ret0
+    { INST_NOP, 0, 0, 4 }, // nop
+    // a single byte at patch_offset 2, 1 for subs imm (0x71...) and 0 for subs reg (0x6B...),
+    // which is bit 28 of the instruction.
+    { 0, 0x1, 28, 1 }, // subs
+    { 0x14000000, 0x7FFFF, 5, 4 }, // b, keeps the offset of the cbz
+    { INST_MOV0, 0, 0, 4 }, // mov0
+};
+
+constexpr InstCond INST_APPLIED[] = {
+    inst_cond(0xFFFFFFFF, INST_RET0), // ret0
+    inst_cond(0xFFFFFFFF, INST_NOP), // nop
+    inst_cond(INST_SUBI_MASK, 0x71000400, INST_SUBR_MASK, 0x6B000000), // subs
+    inst_cond(0xFF000000, 0x14000000), // b
+    inst_cond(0xFFFFFFFF, INST_MOV0), // mov0
+};
+
+static_assert(std::size(INST_CONDS) == (u32)CondId::COUNT);
+static_assert(std::size(INST_PATCHES) == (u32)PatchId::COUNT);
+static_assert(std::size(INST_APPLIED) == (u32)AppliedId::COUNT);
+
+// resolves the version dependent conds, call once on startup.
+// fw_version is in MAKEHOSVERSION format.
+inline void inst_init(u32 fw_version) {
+    // and x0, x19, #0xffffffff before 15.0.0
+    if (fw_version < 0x0F0000) {
+        INST_CONDS[(u32)CondId::MOV2] = inst_cond(0xFF000000, 0x92000000);
+    }
+}
@@ -1,85 +1,334 @@
 #include "minGlue.h"
 #include <string.h>
 
-static bool ini_open(const char* filename, struct NxFile* nxfile, u32 mode) {
+static struct IniGlueStats g_stats = {0};
+
+#if defined __SWITCH__
+
+static FsFileSystem g_fs = {0};
+static bool g_fs_open = false;
+
+static u64 glue_time_ns(void) {
+    return armTicksToNs(armGetSystemTick());
+}
+
+FsFileSystem* ini_fs_get(void) {
+    if (!g_fs_open) {
+        g_stats.fs_opens++;
+        if (R_FAILED(fsOpenSdCardFileSystem(&g_fs))) {
+            return NULL;
+        }
+        g_fs_open = true;
+    }
+    return &g_fs;
+}
+
+void ini_fs_exit(void) {
+    if (g_fs_open) {
+        fsFsClose(&g_fs);
+        g_fs_open = false;
+    }
+}
+
+static bool glue_open(const char* filename, struct NxFile* nxfile, u32 mode) {
     Result rc = {0};
+    FsFileSystem* fs = {0};
     char filename_buf[FS_MAX_PATH] = {0};
 
-    if (R_FAILED(rc = fsOpenSdCardFileSystem(&nxfile->system))) {
+    if (!(fs = ini_fs_get())) {
         return false;
     }
 
     strcpy(filename_buf, filename);
 
-    if (R_FAILED(rc = fsFsOpenFile(&nxfile->system, filename_buf, mode, &nxfile->file))) {
-        if (mode & FsOpenMode_Write) {
-            if (R_FAILED(rc = fsFsCreateFile(&nxfile->system, filename_buf, 0, 0))) {
-                fsFsClose(&nxfile->system);
-                return false;
-            } else {
-                if (R_FAILED(rc = fsFsOpenFile(&nxfile->system, filename_buf, mode, &nxfile->file))) {
-                    fsFsClose(&nxfile->system);
-                    return false;
-                }
-            }
-        } else {
-            fsFsClose(&nxfile->system);
+    g_stats.file_opens++;
+    if (R_FAILED(rc = fsFsOpenFile(fs, filename_buf, mode, &nxfile->file))) {
+        if (!(mode & FsOpenMode_Write)) {
+            return false;
+        }
+        if (R_FAILED(rc = fsFsCreateFile(fs, filename_buf, 0, 0))) {
+            return false;
+        }
+        g_stats.file_opens++;
+        if (R_FAILED(rc = fsFsOpenFile(fs, filename_buf, mode, &nxfile->file))) {
             return false;
         }
     }
 
-    nxfile->offset = 0;
     return true;
 }
 
+static void glue_close(struct NxFile* nxfile) {
+    fsFileClose(&nxfile->file);
+}
+
+static bool glue_read_at(struct NxFile* nxfile, s64 offset, void* buf, u64 size, u64* bytes_read) {
+    g_stats.reads++;
+    return R_SUCCEEDED(fsFileRead(&nxfile->file, offset, buf, size, FsReadOption_None, bytes_read));
+}
+
+static bool glue_write_at(struct NxFile* nxfile, s64 offset, const void* buf, u64 size) {
+    g_stats.writes++;
+    return R_SUCCEEDED(fsFileWrite(&nxfile->file, offset, buf, size, FsWriteOption_None));
+}
+
+static bool glue_rename(const char* src, const char* dst) {
+    FsFileSystem* fs = {0};
+    char src_buf[FS_MAX_PATH] = {0};
+    char dst_buf[FS_MAX_PATH] = {0};
+
+    if (!(fs = ini_fs_get())) {
+        return false;
+    }
+
+    strcpy(src_buf, src);
+    strcpy(dst_buf, dst);
+    g_stats.renames++;
+    return R_SUCCEEDED(fsFsRenameFile(fs, src_buf, dst_buf));
+}
+
+static bool glue_remove(const char* filename) {
+    FsFileSystem* fs = {0};
+    char filename_buf[FS_MAX_PATH] = {0};
+
+    if (!(fs = ini_fs_get())) {
+        return false;
+    }
+
+    strcpy(filename_buf, filename);
+    g_stats.removes++;
+    return R_SUCCEEDED(fsFsDeleteFile(fs, filename_buf));
+}
+
+#else // host backend, so that the number of calls can be measured on a pc
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+static char g_root[PATH_MAX] = ".";
+static u64 g_latency_ns = 0;
+
+static u64 glue_time_ns(void) {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+static void glue_latency(void) {
+    if (g_latency_ns) {
+        const struct timespec ts = { (time_t)(g_latency_ns / 1000000000ULL), (long)(g_latency_ns % 1000000000ULL) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void glue_path(char* out, const char* filename) {
+    snprintf(out, PATH_MAX, "%s%s", g_root, filename);
+}
+
+void ini_host_set_root(const char* root) {
+    snprintf(g_root, sizeof(g_root), "%s", root);
+}
+
+void ini_host_set_latency(u64 ns) {
+    g_latency_ns = ns;
+}
+
+void ini_fs_exit(void) {
+}
+
+static bool glue_open(const char* filename, struct NxFile* nxfile, u32 mode) {
+    char path[PATH_MAX] = {0};
+    glue_path(path, filename);
+
+    if (!g_stats.fs_opens) {
+        g_stats.fs_opens++;
+    }
+    g_stats.file_opens++;
+    glue_latency();
+    nxfile->fd = open(path, mode ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    return nxfile->fd >= 0;
+}
+
+static void glue_close(struct NxFile* nxfile) {
+    close(nxfile->fd);
+}
+
+static bool glue_read_at(struct NxFile* nxfile, s64 offset, void* buf, u64 size, u64* bytes_read) {
+    g_stats.reads++;
+    glue_latency();
+    const ssize_t rc = pread(nxfile->fd, buf, size, offset);
+    *bytes_read = rc > 0 ? (u64)rc : 0;
+    return rc >= 0;
+}
+
+static bool glue_write_at(struct NxFile* nxfile, s64 offset, const void* buf, u64 size) {
+    g_stats.writes++;
+    glue_latency();
+    return pwrite(nxfile->fd, buf, size, offset) == (ssize_t)size;
+}
+
+static bool glue_rename(const char* src, const char* dst) {
+    char src_path[PATH_MAX] = {0};
+    char dst_path[PATH_MAX] = {0};
+    glue_path(src_path, src);
+    glue_path(dst_path, dst);
+
+    g_stats.renames++;
+    glue_latency();
+    return rename(src_path, dst_path) == 0;
+}
+
+static bool glue_remove(const char* filename) {
+    char path[PATH_MAX] = {0};
+    glue_path(path, filename);
+
+    g_stats.removes++;
+    glue_latency();
+    return unlink(path) == 0;
+}
+
+#endif // __SWITCH__
+
+// writes out any pending data, the buffer is left empty
+static bool ini_flush(struct NxFile* nxfile) {
+    bool ok = true;
+
+    if (nxfile->dirty && nxfile->buf_size) {
+        const u64 start = glue_time_ns();
+        ok = glue_write_at(nxfile, nxfile->buf_offset, nxfile->buf, nxfile->buf_size);
+        g_stats.time_ns += glue_time_ns() - start;
+        if (ok) {
+            g_stats.bytes_written += nxfile->buf_size;
+        }
+    }
+
+    nxfile->dirty = false;
+    nxfile->buf_size = 0;
+    return ok;
+}
+
+// reads the block starting at the current offset
+static bool ini_fill(struct NxFile* nxfile) {
+    u64 bytes_read = {0};
+
+    if (!ini_flush(nxfile)) {
+        return false;
+    }
+
+    const u64 start = glue_time_ns();
+    const bool ok = glue_read_at(nxfile, nxfile->offset, nxfile->buf, sizeof(nxfile->buf), &bytes_read);
+    g_stats.time_ns += glue_time_ns() - start;
+    if (!ok) {
+        return false;
+    }
+
+    g_stats.bytes_read += bytes_read;
+    nxfile->buf_offset = nxfile->offset;
+    nxfile->buf_size = bytes_read;
+    return bytes_read != 0;
+}
+
+static bool ini_open(const char* filename, struct NxFile* nxfile, u32 mode) {
+    const u64 start = glue_time_ns();
+    const bool ok = glue_open(filename, nxfile, mode);
+    g_stats.time_ns += glue_time_ns() - start;
+
+    nxfile->offset = 0;
+    nxfile->buf_offset = 0;
+    nxfile->buf_size = 0;
+    nxfile->dirty = false;
+    return ok;
+}
+
+#if defined __SWITCH__
+#define INI_MODE_READ FsOpenMode_Read
+#define INI_MODE_WRITE (FsOpenMode_Write|FsOpenMode_Append)
+#define INI_MODE_REWRITE (FsOpenMode_Read|FsOpenMode_Write|FsOpenMode_Append)
+#else
+#define INI_MODE_READ 0
+#define INI_MODE_WRITE 1
+#define INI_MODE_REWRITE 1
+#endif
+
 bool ini_openread(const char* filename, struct NxFile* nxfile) {
-    return ini_open(filename, nxfile, FsOpenMode_Read);
+    return ini_open(filename, nxfile, INI_MODE_READ);
 }
 
 bool ini_openwrite(const char* filename, struct NxFile* nxfile) {
-    return ini_open(filename, nxfile, FsOpenMode_Write|FsOpenMode_Append);
+    return ini_open(filename, nxfile, INI_MODE_WRITE);
 }
 
 bool ini_openrewrite(const char* filename, struct NxFile* nxfile) {
-    return ini_open(filename, nxfile, FsOpenMode_Read|FsOpenMode_Write|FsOpenMode_Append);
+    return ini_open(filename, nxfile, INI_MODE_REWRITE);
 }
 
 bool ini_close(struct NxFile* nxfile) {
-    fsFileClose(&nxfile->file);
-    fsFsClose(&nxfile->system);
-    return true;
+    const bool ok = ini_flush(nxfile);
+    glue_close(nxfile);
+    return ok;
 }
 
+// same as fgets(), reads up to and including the next newline
 bool ini_read(char* buffer, u64 size, struct NxFile* nxfile) {
-    u64 bytes_read = {0};
-    if (R_FAILED(fsFileRead(&nxfile->file, nxfile->offset, buffer, size, FsReadOption_None, &bytes_read))) {
-        return false;
-    }
+    u64 len = {0};
 
-    if (!bytes_read) {
+    if (!size) {
         return false;
     }
 
-    char *eol = {0};
+    while (len < size - 1) {
+        if (nxfile->dirty || nxfile->offset < nxfile->buf_offset || nxfile->offset >= nxfile->buf_offset + (s64)nxfile->buf_size) {
+            if (!ini_fill(nxfile)) {
+                break;
+            }
+        }
 
-    if ((eol = strchr(buffer, '\n')) == NULL) {
-        eol = strchr(buffer, '\r');
-    }
+        const char c = nxfile->buf[nxfile->offset - nxfile->buf_offset];
+        buffer[len++] = c;
+        nxfile->offset++;
 
-    if (eol != NULL) {
-        *++eol = '\0';
-        bytes_read = eol - buffer;
+        if (c == '\n') {
+            break;
+        }
     }
 
-    nxfile->offset += bytes_read;
-    return true;
+    buffer[len] = '\0';
+    return len != 0;
 }
 
 bool ini_write(const char* buffer, struct NxFile* nxfile) {
-    const size_t size = strlen(buffer);
-    if (R_FAILED(fsFileWrite(&nxfile->file, nxfile->offset, buffer, size, FsWriteOption_None))) {
-        return false;
+    const u64 size = strlen(buffer);
+
+    // drop any read-ahead, or flush if the write doesn't follow the pending data
+    if (!nxfile->dirty) {
+        nxfile->buf_size = 0;
+    } else if (nxfile->offset != nxfile->buf_offset + (s64)nxfile->buf_size || nxfile->buf_size + size > sizeof(nxfile->buf)) {
+        if (!ini_flush(nxfile)) {
+            return false;
+        }
+    }
+
+    // large writes skip the buffer
+    if (size >= sizeof(nxfile->buf)) {
+        const u64 start = glue_time_ns();
+        const bool ok = glue_write_at(nxfile, nxfile->offset, buffer, size);
+        g_stats.time_ns += glue_time_ns() - start;
+        if (!ok) {
+            return false;
+        }
+        g_stats.bytes_written += size;
+    } else {
+        if (!nxfile->buf_size) {
+            nxfile->buf_offset = nxfile->offset;
+        }
+        memcpy(nxfile->buf + nxfile->buf_size, buffer, size);
+        nxfile->buf_size += size;
+        nxfile->dirty = true;
     }
+
     nxfile->offset += size;
     return true;
 }
@@ -95,33 +344,23 @@ bool ini_seek(struct NxFile* nxfile, s64* pos) {
 }
 
 bool ini_rename(const char* src, const char* dst) {
-    Result rc = {0};
-    FsFileSystem fs = {0};
-    char src_buf[FS_MAX_PATH] = {0};
-    char dst_buf[FS_MAX_PATH] = {0};
-
-    if (R_FAILED(rc = fsOpenSdCardFileSystem(&fs))) {
-        return false;
-    }
-
-    strcpy(src_buf, src);
-    strcpy(dst_buf, dst);
-    rc = fsFsRenameFile(&fs, src_buf, dst_buf);
-    fsFsClose(&fs);
-    return R_SUCCEEDED(rc);
+    const u64 start = glue_time_ns();
+    const bool ok = glue_rename(src, dst);
+    g_stats.time_ns += glue_time_ns() - start;
+    return ok;
 }
 
 bool ini_remove(const char* filename) {
-    Result rc = {0};
-    FsFileSystem fs = {0};
-    char filename_buf[FS_MAX_PATH] = {0};
+    const u64 start = glue_time_ns();
+    const bool ok = glue_remove(filename);
+    g_stats.time_ns += glue_time_ns() - start;
+    return ok;
+}
 
-    if (R_FAILED(rc = fsOpenSdCardFileSystem(&fs))) {
-        return false;
-    }
+const struct IniGlueStats* ini_glue_stats(void) {
+    return &g_stats;
+}
 
-    strcpy(filename_buf, filename);
-    rc = fsFsDeleteFile(&fs, filename_buf);
-    fsFsClose(&fs);
-    return R_SUCCEEDED(rc);
+void ini_glue_stats_reset(void) {
+    memset(&g_stats, 0, sizeof(g_stats));
 }
@@ -4,12 +4,50 @@
 extern "C" {
 #endif
 
+#if defined __SWITCH__
 #include <switch.h>
+#else
+// host build, the files live under the directory set by ini_host_set_root()
+#include <stdbool.h>
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+#endif
+
+// size of the read-ahead / write-behind buffer of each open file.
+// note: minIni keeps up to two files open on the stack at once.
+#if !defined INI_BLOCK_SIZE
+#define INI_BLOCK_SIZE 0x200
+#endif
 
 struct NxFile {
+#if defined __SWITCH__
     FsFile file;
-    FsFileSystem system;
-    s64 offset;
+#else
+    int fd;
+#endif
+    s64 offset; // position as seen by minIni
+    s64 buf_offset; // file position of buf[0]
+    u64 buf_size; // number of valid (or pending, if dirty) bytes in buf
+    bool dirty; // buf holds data that has yet to be written
+    char buf[INI_BLOCK_SIZE];
+};
+
+// every call that goes to the filesystem (an ipc on the switch).
+struct IniGlueStats {
+    u32 fs_opens;
+    u32 file_opens;
+    u32 reads;
+    u32 writes;
+    u32 renames;
+    u32 removes;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 time_ns; // time spent in the above calls
 };
 
 #define INI_FILETYPE struct NxFile
@@ -28,6 +66,19 @@ bool ini_seek(struct NxFile* nxfile, s64* pos);
 bool ini_rename(const char* src, const char* dst);
 bool ini_remove(const char* filename);
 
+// the sd card filesystem is opened on first use and shared by every ini call.
+// call ini_fs_exit() before fsExit().
+void ini_fs_exit(void);
+#if defined __SWITCH__
+FsFileSystem* ini_fs_get(void);
+#else
+void ini_host_set_root(const char* root);
+void ini_host_set_latency(u64 ns); // simulated latency added to every call
+#endif
+
+const struct IniGlueStats* ini_glue_stats(void);
+void ini_glue_stats_reset(void);
+
 #if defined __cplusplus
 } // extern "C" {
 #endif
@@ -949,4 +949,247 @@ int ini_putf(const TCHAR *Section, const TCHAR *Key, INI_REAL Value, const TCHAR
   return ini_puts(Section, Key, LocalBuffer, Filename);
 }
 #endif /* INI_REAL */
+
+/* copies the line that starts at Pos into LocalBuffer (zero-terminated and
+ * without the line terminator), returns the position of the next line
+ */
+static int batch_readline(const INI_BATCH *Batch, int Pos, TCHAR *LocalBuffer)
+{
+  int len = 0;
+
+  while (Pos < Batch->Length && Batch->Buffer[Pos] != '\n') {
+    if (len < INI_BUFFERSIZE - 1)
+      LocalBuffer[len++] = Batch->Buffer[Pos];
+    Pos++;
+  }
+  if (Pos < Batch->Length)
+    Pos++;  /* skip the '\n' */
+  LocalBuffer[len] = '\0';
+  return Pos;
+}
+
+/* replaces Remove characters at Pos by Text */
+static int batch_splice(INI_BATCH *Batch, int Pos, int Remove, const TCHAR *Text)
+{
+  int len = (int)_tcslen(Text);
+
+  if (Batch->Length - Remove + len >= Batch->BufferSize) {
+    Batch->Error = 1;
+    return 0;
+  }
+  /* the move includes the zero terminator */
+  memmove(Batch->Buffer + Pos + len, Batch->Buffer + Pos + Remove, (Batch->Length - Pos - Remove + 1) * sizeof(TCHAR));
+  memcpy(Batch->Buffer + Pos, Text, len * sizeof(TCHAR));
+  Batch->Length += len - Remove;
+  Batch->Dirty = 1;
+  return 1;
+}
+
+/* inserts Text as a new line at Pos, terminating the line above it if needed */
+static int batch_insertline(INI_BATCH *Batch, int Pos, const TCHAR *Text)
+{
+  if (Pos > 0 && Batch->Buffer[Pos - 1] != '\n') {
+    if (!batch_splice(Batch, Pos, 0, INI_LINETERM))
+      return 0;
+    Pos += (int)_tcslen(INI_LINETERM);
+  }
+  return batch_splice(Batch, Pos, 0, Text);
+}
+
+/** ini_batch_begin()
+ * \param Batch       the batch to initialize
+ * \param Buffer      a pointer to the buffer that the file is assembled in
+ * \param BufferSize  the size of Buffer in characters
+ * \param Truncate    if non-zero, the current contents of the file are discarded,
+ *                    otherwise the file is read into Buffer so that the batch
+ *                    only adds to (or replaces) existing settings
+ * \param Filename    the name and full path of the .ini file to write to
+ *
+ * \return            1 if successful, 0 if the file does not fit in Buffer
+ */
+int ini_batch_begin(INI_BATCH *Batch, TCHAR *Buffer, int BufferSize, int Truncate, const TCHAR *Filename)
+{
+  INI_FILETYPE fp;
+  TCHAR LocalBuffer[INI_BUFFERSIZE];
+  int len;
+
+  assert(Batch != NULL);
+  assert(Buffer != NULL && BufferSize > 0);
+  assert(Filename != NULL);
+  Batch->Filename = Filename;
+  Batch->Buffer = Buffer;
+  Batch->BufferSize = BufferSize;
+  Batch->Length = 0;
+  Batch->Loaded = 0;
+  Batch->Dirty = 0;
+  Batch->Error = 0;
+  Buffer[0] = '\0';
+
+  if (Truncate) {
+    Batch->Dirty = 1;   /* an empty batch still truncates the file */
+    return 1;
+  }
+  if (!ini_openread(Filename, &fp))
+    return 1;           /* no file yet, start empty */
+
+  Batch->Loaded = 1;
+  while (ini_read(LocalBuffer, INI_BUFFERSIZE, &fp)) {
+    len = (int)_tcslen(LocalBuffer);
+    if (Batch->Length + len >= BufferSize) {
+      Batch->Error = 1;
+      break;
+    }
+    _tcscpy(Buffer + Batch->Length, LocalBuffer);
+    Batch->Length += len;
+  }
+  (void)ini_close(&fp);
+  return !Batch->Error;
+}
+
+/** ini_batch_puts()
+ * \param Batch       the batch, as set up by ini_batch_begin()
+ * \param Section     the name of the section to write the string in
+ * \param Key         the name of the entry to write
+ * \param Value       a pointer to the buffer the string
+ *
+ * \return            1 if successful, 0 if the buffer of the batch is full
+ */
+int ini_batch_puts(INI_BATCH *Batch, const TCHAR *Section, const TCHAR *Key, const TCHAR *Value)
+{
+  TCHAR LocalBuffer[INI_BUFFERSIZE];
+  TCHAR *sp, *ep;
+  enum quote_option quotes;
+  int pos, next, start, end, len;
+
+  assert(Batch != NULL);
+  if (Key == NULL || Value == NULL || Batch->Error)
+    return 0;
+
+  /* find the start of the section, keys without a section are stored above
+   * the first section
+   */
+  start = 0;
+  len = (Section != NULL) ? (int)_tcslen(Section) : 0;
+  if (len > 0) {
+    start = -1;
+    for (pos = 0; pos < Batch->Length && start < 0; pos = next) {
+      next = batch_readline(Batch, pos, LocalBuffer);
+      sp = skipleading(LocalBuffer);
+      ep = _tcsrchr(sp, ']');
+      if (*sp == '[' && ep != NULL) {
+        sp = skipleading(sp + 1);
+        ep = skiptrailing(ep, sp);
+        if ((int)(ep - sp) == len && _tcsnicmp(sp, Section, len) == 0)
+          start = next;
+      }
+    }
+    if (start < 0) {
+      /* section not found, so add one to the end */
+      writesection(LocalBuffer, Section, NULL);
+      if (!batch_insertline(Batch, Batch->Length, LocalBuffer))
+        return 0;
+      writekey(LocalBuffer, Key, Value, NULL);
+      return batch_splice(Batch, Batch->Length, 0, LocalBuffer);
+    }
+  }
+
+  /* find the key in the section; new keys go behind the last non-empty line
+   * of the section
+   */
+  len = (int)_tcslen(Key);
+  end = start;
+  for (pos = start; pos < Batch->Length; pos = next) {
+    next = batch_readline(Batch, pos, LocalBuffer);
+    sp = skipleading(LocalBuffer);
+    if (*sp == '[')
+      break;
+    if (*sp == '\0')
+      continue;
+    end = next;
+    if (*sp == ';' || *sp == '#')
+      continue;
+    ep = _tcschr(sp, '=');
+    if (ep == NULL)
+      ep = _tcschr(sp, ':');
+    if (ep != NULL && (int)(skiptrailing(ep, sp) - sp) == len && _tcsnicmp(sp, Key, len) == 0) {
+      /* if the current setting is identical to the one to write, there is
+       * nothing to do
+       */
+      sp = cleanstring(skipleading(ep + 1), &quotes);
+      if (_tcscmp(sp, Value) == 0)
+        return 1;
+      writekey(LocalBuffer, Key, Value, NULL);
+      return batch_splice(Batch, pos, next - pos, LocalBuffer);
+    }
+  }
+  writekey(LocalBuffer, Key, Value, NULL);
+  return batch_insertline(Batch, end, LocalBuffer);
+}
+
+/** ini_batch_putl()
+ * \param Batch       the batch, as set up by ini_batch_begin()
+ * \param Section     the name of the section to write the value in
+ * \param Key         the name of the entry to write
+ * \param Value       the value to write
+ *
+ * \return            1 if successful, 0 if the buffer of the batch is full
+ */
+int ini_batch_putl(INI_BATCH *Batch, const TCHAR *Section, const TCHAR *Key, long Value)
+{
+  TCHAR LocalBuffer[32];
+  long2str(Value, LocalBuffer);
+  return ini_batch_puts(Batch, Section, Key, LocalBuffer);
+}
+
+/** ini_batch_commit()
+ * \param Batch       the batch, as set up by ini_batch_begin()
+ *
+ * A batch that was loaded from an existing file is written to a temporary
+ * file that then replaces the original (a single rewrite), otherwise the file
+ * is created and written in one go. Nothing is written if no setting changed.
+ *
+ * \return            1 if successful, otherwise 0
+ */
+int ini_batch_commit(INI_BATCH *Batch)
+{
+  INI_FILETYPE wfp;
+  TCHAR LocalBuffer[INI_BUFFERSIZE];
+  int ok;
+
+  assert(Batch != NULL);
+  if (Batch->Error)
+    return 0;
+  if (!Batch->Dirty)
+    return 1;
+
+  if (Batch->Loaded) {
+    ini_tempname(LocalBuffer, Batch->Filename, INI_BUFFERSIZE);
+    #if defined ini_remove || defined INI_REMOVE
+      (void)ini_remove(LocalBuffer);  /* in case a stale temporary file was left behind */
+    #endif
+    if (!ini_openwrite(LocalBuffer, &wfp))
+      return 0;
+    ok = (Batch->Length == 0) || ini_write(Batch->Buffer, &wfp);
+    (void)ini_close(&wfp);
+    if (!ok)
+      return 0;
+    #if defined ini_remove || defined INI_REMOVE
+      (void)ini_remove(Batch->Filename);
+    #endif
+    (void)ini_rename(LocalBuffer, Batch->Filename);
+  } else {
+    #if defined ini_remove || defined INI_REMOVE
+      (void)ini_remove(Batch->Filename);
+    #endif
+    if (!ini_openwrite(Batch->Filename, &wfp))
+      return 0;
+    ok = (Batch->Length == 0) || ini_write(Batch->Buffer, &wfp);
+    (void)ini_close(&wfp);
+    if (!ok)
+      return 0;
+  }
+
+  Batch->Dirty = 0;
+  return 1;
+}
 #endif /* !INI_READONLY */
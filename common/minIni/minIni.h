@@ -56,6 +56,25 @@ int   ini_puts(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, co
 #if defined INI_REAL
 int   ini_putf(const mTCHAR *Section, const mTCHAR *Key, INI_REAL Value, const mTCHAR *Filename);
 #endif
+
+/* A batch collects many settings in a caller supplied buffer and writes the
+ * whole file at once in ini_batch_commit(), rather than rewriting the file for
+ * every key as ini_puts() does.
+ */
+typedef struct {
+  const mTCHAR *Filename;
+  mTCHAR *Buffer;
+  int BufferSize;
+  int Length;   /* number of characters in Buffer, excluding the terminator */
+  int Loaded;   /* the file existed and was read into Buffer */
+  int Dirty;    /* Buffer differs from the file */
+  int Error;    /* Buffer overflowed, the batch will not be written */
+} INI_BATCH;
+
+int   ini_batch_begin(INI_BATCH *Batch, mTCHAR *Buffer, int BufferSize, int Truncate, const mTCHAR *Filename);
+int   ini_batch_puts(INI_BATCH *Batch, const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value);
+int   ini_batch_putl(INI_BATCH *Batch, const mTCHAR *Section, const mTCHAR *Key, long Value);
+int   ini_batch_commit(INI_BATCH *Batch);
 #endif /* INI_READONLY */
 
 #if !defined INI_NOBROWSE
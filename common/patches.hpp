@@ -0,0 +1,55 @@
+#pragma once
+
+#include <span>
+#include "minIni/minGlue.h" // for the u8-u64 types
+#include "pattern.hpp"
+#include "inst.hpp"
+#include "scanner.hpp"
+
+// the built-in patterns, used when there's no pattern database (tools/patterns.txt mirrors them).
+// shared with tools/src/arena-check.cpp, so that they're checked on a pc too.
+
+// from libnx, for the host tools
+#if !defined MAKEHOSVERSION
+#define MAKEHOSVERSION(_major, _minor, _micro) (((u32)(_major) << 16) | ((u32)(_minor) << 8) | (u32)(_micro))
+#endif
+
+struct PatchEntry {
+    const char* name; // name of the system title
+    u64 title_id; // title id of the system title
+    std::span<const Patterns> patterns; // list of patterns to find
+    u32 min_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    u32 max_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+};
+
+constexpr Patterns fs_patterns[] = {
+    { "noacidsigchk1", "0xC8FE4739"_pat, -24, 0, CondId::BL, PatchId::RET0, AppliedId::RET0, FW_VER_ANY, MAKEHOSVERSION(9,2,0) },
+    { "noacidsigchk2", "0x0210911F000072"_pat, -5, 0, CondId::BL, PatchId::RET0, AppliedId::RET0, FW_VER_ANY, MAKEHOSVERSION(9,2,0) },
+    { "noncasigchk_old", "0x1E42B9"_pat, -5, 0, CondId::TBZ, PatchId::NOP, AppliedId::NOP, MAKEHOSVERSION(10,0,0), MAKEHOSVERSION(14,2,1) },
+    { "noncasigchk_new", "0x3E4479"_pat, -5, 0, CondId::TBZ, PatchId::NOP, AppliedId::NOP, MAKEHOSVERSION(15,0,0) },
+    { "nocntchk_old", "0x081C00121F05007181000054"_pat, -4, 0, CondId::BL, PatchId::RET0, AppliedId::RET0, MAKEHOSVERSION(10,0,0), MAKEHOSVERSION(14,2,1) },
+    { "nocntchk_new", "0x081C00121F05007141010054"_pat, -4, 0, CondId::BL, PatchId::RET0, AppliedId::RET0, MAKEHOSVERSION(15,0,0) },
+};
+
+constexpr Patterns ldr_patterns[] = {
+    { "noacidsigchk", "0xFD7BC6A8C0035FD6"_pat, 16, 2, CondId::SUBS, PatchId::SUBS, AppliedId::SUBS },
+};
+
+constexpr Patterns es_patterns[] = {
+    { "es1", "0x1F90013128928052"_pat, -4, 0, CondId::CBZ, PatchId::B, AppliedId::B, FW_VER_ANY, MAKEHOSVERSION(13,2,1) },
+    { "es2", "0xC07240F9E1930091"_pat, -4, 0, CondId::TBZ, PatchId::NOP, AppliedId::NOP, FW_VER_ANY, MAKEHOSVERSION(10,2,0) },
+    { "es3", "0xF3031FAA02000014"_pat, -4, 0, CondId::BNE, PatchId::NOP, AppliedId::NOP, FW_VER_ANY, MAKEHOSVERSION(10,2,0) },
+    { "es4", "0xC0FDFF35A8C35838"_pat, -4, 0, CondId::MOV, PatchId::NOP, AppliedId::NOP, MAKEHOSVERSION(11,0,0), MAKEHOSVERSION(13,2,1) },
+    { "es5", "0xE023009145EEFF97"_pat, -4, 0, CondId::CBZ, PatchId::B, AppliedId::B, MAKEHOSVERSION(11,0,0), MAKEHOSVERSION(13,2,1) },
+    { "es6", "0x.6300...0094A0..D1..FF97"_pat, 16, 0, CondId::MOV2, PatchId::MOV0, AppliedId::MOV0, MAKEHOSVERSION(14,0,0) },
+};
+
+// NOTE: add system titles that you want to be patched to this table.
+// a list of system titles can be found here https://switchbrew.org/wiki/Title_list
+constexpr PatchEntry patches[] = {
+    { "fs", 0x0100000000000000, fs_patterns },
+    // ldr needs to be patched in fw 10+
+    { "ldr", 0x0100000000000001, ldr_patterns, MAKEHOSVERSION(10,0,0) },
+    // es was added in fw 2
+    { "es", 0x0100000000000033, es_patterns, MAKEHOSVERSION(2,0,0) },
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <array>
+#include <cstddef> // for size_t
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+constexpr u32 PATTERN_MAX_SIZE = 0xFF; // size is stored in a u8
+constexpr u32 PATTERN_MAX_ALTS = 4; // most alternations in a pattern
+constexpr u32 PATTERN_MAX_ALT_VALUES = 4; // most values in an alternation
+constexpr u32 PATTERN_ALT_SIZE = 2 + PATTERN_MAX_ALT_VALUES; // offset, count, values
+
+// the layout of a parsed pattern: value[size], mask[size], then alt_count alternations
+// of {offset, count, values[PATTERN_MAX_ALT_VALUES]}.
+struct PatternInfo {
+    bool ok;
+    u8 size;
+    u8 alt_count;
+    u8 anchor_offset; // longest run of fully masked bytes, compared first when scanning
+    u8 anchor_size;
+
+    constexpr auto bytes() const -> u32 {
+        return size * 2 + alt_count * PATTERN_ALT_SIZE;
+    }
+};
+
+// parses a pattern, writing it to out (if not null) and returns its layout.
+// whitespace is ignored, data matches if (data & mask) == value.
+// a pattern needs at least one byte without wildcards.
+//  E0          a byte
+//  E? or ?0    a nibble, ?? or . for any byte
+//  [1110xxxx]  a byte by bit, msb first, x for any bit
+//  (E0|F1)     one of 2 to PATTERN_MAX_ALT_VALUES bytes
+// eg, "0x.6300" -> value {00, 63, 00} mask {00, FF, FF}
+constexpr auto pattern_parse(const char* s, u8* out = nullptr) -> PatternInfo {
+    constexpr auto hexstr_2_nibble = [](char c) -> s32 {
+        if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+        if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+        if (c >= '0' && c <= '9') { return c - '0'; }
+        return -1;
+    };
+
+    // the size is needed to know where the mask starts, so when writing
+    // the string is measured first
+    PatternInfo info{};
+    if (out) {
+        info = pattern_parse(s);
+        if (!info.ok) {
+            return info;
+        }
+    }
+    const u32 mask_offset = info.size;
+    const u32 alt_offset = info.size * 2;
+
+    u32 size{};
+    u32 alt_count{};
+    u32 run{};
+    info.anchor_offset = info.anchor_size = 0;
+
+    const auto emit = [&](u8 value, u8 mask) {
+        if (out) {
+            out[size] = value & mask;
+            out[mask_offset + size] = mask;
+        }
+        run = mask == 0xFF ? run + 1 : 0;
+        if (run > info.anchor_size) {
+            info.anchor_offset = size + 1 - run;
+            info.anchor_size = run;
+        }
+        size++;
+    };
+
+    // skip leading 0x (if any)
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+    }
+
+    while (*s != '\0') {
+        if (*s == ' ' || *s == '\t') {
+            s++;
+            continue;
+        }
+
+        if (size >= PATTERN_MAX_SIZE) {
+            return {};
+        }
+
+        if (*s == '.') {
+            emit(0, 0);
+            s++;
+        } else if (*s == '[') {
+            u8 value{}, mask{};
+            for (u32 bit = 0; bit < 8; bit++) {
+                const auto c = s[1 + bit];
+                if (c != '0' && c != '1' && c != 'x' && c != 'X') {
+                    return {};
+                }
+                value = (value << 1) | (c == '1');
+                mask = (mask << 1) | (c == '0' || c == '1');
+            }
+            if (s[9] != ']') {
+                return {};
+            }
+            emit(value, mask);
+            s += 10;
+        } else if (*s == '(') {
+            u8 values[PATTERN_MAX_ALT_VALUES]{};
+            u32 count{};
+            s++;
+            for (;;) {
+                const auto hi = hexstr_2_nibble(s[0]);
+                const auto lo = hi < 0 ? -1 : hexstr_2_nibble(s[1]);
+                if (lo < 0 || count == PATTERN_MAX_ALT_VALUES) {
+                    return {};
+                }
+                values[count] = (hi << 4) | lo;
+                for (u32 i = 0; i < count; i++) {
+                    if (values[i] == values[count]) {
+                        return {};
+                    }
+                }
+                count++;
+                s += 2;
+                if (*s == ')') {
+                    s++;
+                    break;
+                }
+                if (*s++ != '|') {
+                    return {};
+                }
+            }
+            if (count < 2) {
+                return {};
+            }
+
+            // the bits all of the values share go in the mask, which rejects most
+            // positions. the values are only checked if the mask can't represent them.
+            u8 diff{};
+            for (u32 i = 1; i < count; i++) {
+                diff |= values[0] ^ values[i];
+            }
+            const u8 mask = ~diff;
+            if (count != (1U << __builtin_popcount(diff))) {
+                if (alt_count == PATTERN_MAX_ALTS) {
+                    return {};
+                }
+                if (out) {
+                    const auto alt = out + alt_offset + alt_count * PATTERN_ALT_SIZE;
+                    alt[0] = size;
+                    alt[1] = count;
+                    for (u32 i = 0; i < count; i++) {
+                        alt[2 + i] = values[i];
+                    }
+                }
+                alt_count++;
+            }
+            emit(values[0], mask);
+        } else {
+            const auto hi = s[0] == '?' ? 0 : hexstr_2_nibble(s[0]);
+            const auto lo = s[1] == '?' ? 0 : hi < 0 ? -1 : hexstr_2_nibble(s[1]);
+            if (hi < 0 || lo < 0) {
+                return {};
+            }
+            emit((hi << 4) | lo, (s[0] == '?' ? 0x00 : 0xF0) | (s[1] == '?' ? 0x00 : 0x0F));
+            s += 2;
+        }
+    }
+
+    // a pattern without a whole byte has nothing to be bucketed by, and would match everywhere
+    info.ok = size != 0 && info.anchor_size != 0;
+    info.size = size;
+    info.alt_count = alt_count;
+    return info;
+}
+
+// a parsed pattern. the bytes are not owned, they are either in the sysmod's
+// rodata (see _pat below), the pattern database or a buffer of the host tools.
+struct PatternData {
+    constexpr PatternData() = default;
+
+    // data holds info.bytes() bytes, as written by pattern_parse()
+    constexpr PatternData(const u8* data, const PatternInfo& info) :
+        value{data}, mask{data + info.size}, alts{data + info.size * 2},
+        size{info.size}, alt_count{info.alt_count}, anchor_offset{info.anchor_offset}, anchor_size{info.anchor_size} {}
+
+    constexpr auto matches(const u8* data) const -> bool {
+        for (u32 i = 0; i < size; i++) {
+            if ((data[i] & mask[i]) != value[i]) {
+                return false;
+            }
+        }
+
+        for (u32 n = 0; n < alt_count; n++) {
+            const auto alt = alts + n * PATTERN_ALT_SIZE;
+            bool found{};
+            for (u32 i = 0; i < alt[1]; i++) {
+                found |= data[alt[0]] == alt[2 + i];
+            }
+            if (!found) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const u8* value{};
+    const u8* mask{};
+    const u8* alts{};
+    u8 size{};
+    u8 alt_count{};
+    u8 anchor_offset{};
+    u8 anchor_size{};
+};
+
+template<size_t N>
+struct PatternString {
+    constexpr PatternString(const char (&str)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            s[i] = str[i];
+        }
+    }
+
+    char s[N]{};
+};
+
+// one per pattern string, sized to fit exactly
+template<PatternString S>
+struct PatternStorage {
+    static constexpr PatternInfo info = pattern_parse(S.s);
+    static_assert(info.ok, "invalid byte pattern");
+
+    static constexpr auto data = [] {
+        std::array<u8, info.bytes()> data{};
+        pattern_parse(S.s, data.data());
+        return data;
+    }();
+};
+
+// eg, "0x.6300"_pat, parsed at compile-time
+template<PatternString S>
+constexpr auto operator""_pat() -> PatternData {
+    return { PatternStorage<S>::data.data(), PatternStorage<S>::info };
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef> // for offsetof
+#include <cstring>
+#include "minIni/minGlue.h" // for the u8-u64 types
+#include "pattern.hpp"
+#include "inst.hpp"
+
+// compiled pattern database, produced on a pc by tools/patdb-compile from a text
+// source (see tools/patterns.txt) and read by the sysmod with a single read.
+// if the file is missing or invalid, the sysmod uses its built-in tables.
+//
+// layout (all offsets are from the start of the file):
+// - PatternDbHeader
+// - title_count * PatternDbTitle
+// - pattern_count * PatternDbPattern, grouped by title
+// - interval_count * PatternDbInterval, sorted by min_fw
+// - index_count * u16, pattern ids referenced by the intervals, ascending per interval
+// - data_size bytes of pattern data, per pattern as written by pattern_parse(), and
+//   the nul terminated module names / build ids that patterns are limited to
+constexpr auto PATTERN_DB_PATH = "/config/sys-patch/patterns.bin";
+constexpr u32 PATTERN_DB_MAGIC = 0x42445053; // "SPDB"
+constexpr u16 PATTERN_DB_VERSION = 4;
+constexpr u16 PATTERN_DB_NO_PARENT = 0xFFFF;
+constexpr u32 PATTERN_DB_NO_MODULE = 0xFFFFFFFF;
+constexpr u32 PATTERN_DB_MAX_FILE_SIZE = 0x2000; // most the sysmod can load (its arena keeps this much), patdb-compile rejects larger output
+constexpr u32 PATTERN_DB_MODULE_MAX_SIZE = 0x41; // with the nul, enough for a whole build id in hex
+
+struct PatternDbHeader {
+    u32 magic; // PATTERN_DB_MAGIC
+    u16 version; // PATTERN_DB_VERSION
+    u16 header_size; // sizeof(PatternDbHeader)
+    u32 file_size;
+    u16 title_count;
+    u16 pattern_count;
+    u16 interval_count;
+    u16 reserved;
+    u32 index_count;
+    u32 data_size;
+    u32 titles_offset;
+    u32 patterns_offset;
+    u32 intervals_offset;
+    u32 index_offset;
+    u32 data_offset;
+};
+
+struct PatternDbTitle {
+    u64 title_id;
+    char name[8];
+    u32 min_fw; // 0 to ignore
+    u32 max_fw; // 0 to ignore
+};
+
+struct PatternDbPattern {
+    char name[24];
+    u32 min_fw; // 0 to ignore
+    u32 max_fw; // 0 to ignore
+    u32 min_ams; // 0 to ignore
+    u32 max_ams; // 0 to ignore
+    s32 inst_offset; // instruction offset relative to byte pattern
+    s32 patch_offset; // patch offset relative to inst_offset
+    u32 data_offset; // offset of value / mask within the data section
+    u16 title; // index into the title table
+    u8 size; // number of bytes in the pattern
+    u8 anchor_offset; // longest run of fully masked bytes
+    u8 anchor_size;
+    CondId cond;
+    PatchId patch;
+    AppliedId applied;
+    u8 expected_count; // number of places the pattern should match, 0 is treated as 1
+    u8 alt_count; // number of alternations after the mask
+    u8 reserved[2];
+    u16 parent; // pattern id of the parent (same title), PATTERN_DB_NO_PARENT for none
+    u16 window; // the pattern is searched for within +/- window bytes of the parent match
+    u32 module_offset; // of the module name / build id within the data section, PATTERN_DB_NO_MODULE for the title's own code
+};
+
+// the patterns active for fw versions in [min_fw, next interval's min_fw).
+// patterns with no max_fw are in every interval from their min_fw onwards.
+struct PatternDbInterval {
+    u32 min_fw;
+    u32 first; // into the index
+    u32 count;
+};
+
+static_assert(sizeof(PatternDbHeader) == 48);
+static_assert(sizeof(PatternDbTitle) == 24);
+static_assert(sizeof(PatternDbPattern) == 72 && offsetof(PatternDbPattern, data_offset) == 48);
+static_assert(sizeof(PatternDbInterval) == 12);
+
+// returns the header if data holds a complete database, nullptr otherwise
+inline auto pattern_db_validate(const void* data, u64 size) -> const PatternDbHeader* {
+    const auto header = (const PatternDbHeader*)data;
+    if (size < sizeof(PatternDbHeader) || header->magic != PATTERN_DB_MAGIC || header->version != PATTERN_DB_VERSION) {
+        return nullptr;
+    }
+    if (header->header_size != sizeof(PatternDbHeader) || header->file_size > size) {
+        return nullptr;
+    }
+
+    const auto in_file = [size](u64 offset, u64 count, u64 entry_size) {
+        return offset + count * entry_size <= size;
+    };
+
+    if (!in_file(header->titles_offset, header->title_count, sizeof(PatternDbTitle)) ||
+        !in_file(header->patterns_offset, header->pattern_count, sizeof(PatternDbPattern)) ||
+        !in_file(header->intervals_offset, header->interval_count, sizeof(PatternDbInterval)) ||
+        !in_file(header->index_offset, header->index_count, sizeof(u16)) ||
+        !in_file(header->data_offset, header->data_size, 1)) {
+        return nullptr;
+    }
+
+    return header;
+}
+
+inline auto pattern_db_info(const PatternDbPattern& pattern) -> PatternInfo {
+    return { true, pattern.size, pattern.alt_count, pattern.anchor_offset, pattern.anchor_size };
+}
+
+// checks that the pattern's data is in the file, that it has an anchor and that its alternations
+// only reference bytes within the pattern, so that it can be matched without any further checks.
+inline auto pattern_db_check_data(const PatternDbHeader* header, const PatternDbPattern& pattern, const u8* data) -> bool {
+    const auto info = pattern_db_info(pattern);
+    if (!info.size || !info.anchor_size || info.alt_count > PATTERN_MAX_ALTS || info.anchor_offset + info.anchor_size > info.size) {
+        return false;
+    }
+    if ((u64)pattern.data_offset + info.bytes() > header->data_size) {
+        return false;
+    }
+
+    const auto alts = data + pattern.data_offset + info.size * 2;
+    for (u32 n = 0; n < info.alt_count; n++) {
+        const auto alt = alts + n * PATTERN_ALT_SIZE;
+        if (alt[0] >= info.size || alt[1] > PATTERN_MAX_ALT_VALUES) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// checks that the pattern's module, if it has one, is a nul terminated string in the data section
+inline auto pattern_db_check_module(const PatternDbHeader* header, const PatternDbPattern& pattern, const u8* data) -> bool {
+    if (pattern.module_offset == PATTERN_DB_NO_MODULE) {
+        return true;
+    }
+    if (pattern.module_offset >= header->data_size) {
+        return false;
+    }
+    const auto size = header->data_size - pattern.module_offset;
+    return std::memchr(data + pattern.module_offset, 0, size < PATTERN_DB_MODULE_MAX_SIZE ? size : PATTERN_DB_MODULE_MAX_SIZE) != nullptr;
+}
+
+template<typename T>
+inline auto pattern_db_table(const PatternDbHeader* header, u32 offset) -> const T* {
+    return (const T*)((const u8*)header + offset);
+}
+
+// binary search for the interval that contains fw, nullptr if fw is below every interval
+inline auto pattern_db_find_interval(const PatternDbHeader* header, u32 fw) -> const PatternDbInterval* {
+    const auto intervals = pattern_db_table<PatternDbInterval>(header, header->intervals_offset);
+    u32 lo = 0, hi = header->interval_count;
+    while (lo < hi) {
+        const auto mid = (lo + hi) / 2;
+        if (intervals[mid].min_fw <= fw) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? &intervals[lo - 1] : nullptr;
+}
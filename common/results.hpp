@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef> // for offsetof
+#include <utility> // std::unreachable
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+// fixed layout binary copy of the log, written by the sysmod in a single write.
+// readers can mmap / fread it and use it as is, see results_validate().
+//
+// layout: ResultsHeader, then header.entry_count * ResultsEntry.
+// header_size and entry_size allow fields to be appended in later versions
+// without breaking older readers.
+constexpr auto RESULTS_PATH = "/config/sys-patch/results.bin";
+constexpr u32 RESULTS_MAGIC = 0x52505953; // "SYPR"
+constexpr u16 RESULTS_VERSION = 2;
+
+enum class PatchedResult : u8 {
+    NOT_FOUND,
+    SKIPPED,
+    PATCHED_FILE,
+    PATCHED_SYSPATCH,
+    FAILED_WRITE,
+    AMBIGUOUS, // matched a different number of times than expected, so wasn't patched
+    TIMED_OUT, // the title's scan ran out of time before the pattern was found
+};
+
+struct ResultsHeader {
+    u32 magic; // RESULTS_MAGIC
+    u16 version; // RESULTS_VERSION
+    u16 header_size; // sizeof(ResultsHeader)
+    u16 entry_size; // sizeof(ResultsEntry)
+    u16 entry_count;
+    u32 fw_version; // MAKEHOSVERSION format
+    u64 ams_hash;
+    u64 patch_time_ns; // how long it took to patch
+    u32 ams_version;
+    u32 ams_target_version;
+    u8 ams_keygen;
+    u8 is_emummc;
+    u8 patching_enabled;
+    u8 reserved[5];
+    char syspatch_version[32]; // VERSION_WITH_HASH of the sysmod that wrote the file
+};
+
+struct ResultsEntry {
+    u64 title_id;
+    u64 address; // address the patch was (or already had been) applied at, 0 if not found
+    u32 time_us; // time from the start of patching until the result was known
+    u16 pattern_id; // index into the title's pattern table
+    PatchedResult result;
+    u8 match_count; // places the pattern matched, capped at 255
+    char title_name[8];
+    char pattern_name[24];
+    // the process the result was found in, the address is only valid while both are the same
+    u64 process_id; // 0 if the title wasn't found
+    u64 code_addr; // start of the title's own code, which moves with aslr
+};
+
+static_assert(sizeof(ResultsHeader) == 80 && offsetof(ResultsHeader, syspatch_version) == 48);
+static_assert(sizeof(ResultsEntry) == 72 && offsetof(ResultsEntry, pattern_name) == 32);
+
+// returns the header if data holds a complete results file, nullptr otherwise
+inline auto results_validate(const void* data, u64 size) -> const ResultsHeader* {
+    const auto header = (const ResultsHeader*)data;
+    if (size < sizeof(ResultsHeader) || header->magic != RESULTS_MAGIC || header->version < RESULTS_VERSION) {
+        return nullptr;
+    }
+    if (header->header_size < sizeof(ResultsHeader) || header->entry_size < sizeof(ResultsEntry)) {
+        return nullptr;
+    }
+    if (size < header->header_size + (u64)header->entry_size * header->entry_count) {
+        return nullptr;
+    }
+    return header;
+}
+
+inline auto results_entry(const ResultsHeader* header, u32 index) -> const ResultsEntry* {
+    return (const ResultsEntry*)((const u8*)header + header->header_size + (u64)header->entry_size * index);
+}
+
+inline auto patch_result_to_str(PatchedResult result) -> const char* {
+    switch (result) {
+        case PatchedResult::NOT_FOUND: return "Unpatched";
+        case PatchedResult::SKIPPED: return "Skipped";
+        case PatchedResult::PATCHED_FILE: return "Patched (file)";
+        case PatchedResult::PATCHED_SYSPATCH: return "Patched (sys-patch)";
+        case PatchedResult::FAILED_WRITE: return "Failed (svcWriteDebugProcessMemory)";
+        case PatchedResult::AMBIGUOUS: return "Ambiguous";
+        case PatchedResult::TIMED_OUT: return "Timed out";
+    }
+
+    std::unreachable();
+}
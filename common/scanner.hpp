@@ -0,0 +1,597 @@
+#pragma once
+
+#include <algorithm> // for std::min / std::max
+#include <cstring>
+#include <span>
+#include "minIni/minGlue.h" // for the u8-u64 types
+#include "pattern.hpp"
+#include "inst.hpp"
+#include "results.hpp"
+
+// the pattern scanner, shared by the sysmod and the host tools.
+// the memory that's scanned / patched is accessed through a Target, which the sysmod
+// implements with the debug svcs and the host tools with an image loaded into memory:
+//  auto read(void* out, u64 addr, u64 size) -> bool
+//  auto write(const void* data, u64 addr, u64 size) -> bool
+//  auto ticks() -> u64
+// and, to walk a process with scanner_scan_regions():
+//  auto query(u64 addr, ScanRegion& out) -> bool
+
+constexpr u32 SCAN_MAX_PATTERNS = 64; // most patterns searched for in a title at once
+constexpr u32 PATTERN_MAX_MATCHES = 4; // most matches kept per pattern in match all mode
+constexpr u32 PATTERN_MAX_WINDOW = 0x400; // largest window a chained pattern is searched for in
+constexpr u64 WINDOW_BUFFER_SIZE = PATTERN_MAX_WINDOW * 2 + PATTERN_MAX_SIZE; // size of the buffer which windows are read into
+constexpr u32 SCAN_MODULE_NAME_SIZE = 0x40; // longest module name kept, with the nul
+constexpr u32 SCAN_MODULE_MIN_BUILD_ID = 16; // fewest hex digits of a build id that a module is matched by
+constexpr u32 FW_VER_ANY = 0x0;
+
+// read-only, what's found is kept in PatternResult so that tables of these can be in rodata
+struct Patterns {
+    const char* patch_name; // name of patch
+    PatternData byte_pattern; // the pattern to search
+
+    s32 inst_offset; // instruction offset relative to byte pattern
+    s32 patch_offset; // patch offset relative to inst_offset
+
+    CondId cond; // check condition of the instruction
+    PatchId patch; // the patch data to be applied
+    AppliedId applied; // check to see if patch already applied
+
+    u32 min_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    u32 max_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    u32 min_ams_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    u32 max_ams_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    u8 expected_count{1}; // number of places the pattern should match in the title
+    const char* parent{}; // if set, the pattern is only searched for around matches of this pattern
+    u16 window{}; // the pattern must start within +/- window bytes of the start of the parent match
+    const char* module{}; // if set, only searched for in the loaded module with this name or build id, see scanner_module_matches()
+};
+
+// what a memory region holds, see Target::query(). only code that's readable and executable is scanned.
+enum ScanCode : u8 {
+    ScanCode_None,
+    ScanCode_Static, // the title's own code, which every pattern without a module is searched for in
+    ScanCode_Module, // code loaded later (by ro), only read if a pattern names the module
+};
+
+// the memory region that contains an address, see Target::query()
+struct ScanRegion {
+    u64 addr;
+    u64 size;
+    ScanCode code;
+};
+
+// a module loaded by ro, identified from its nro header (see switchbrew.org/wiki/NRO)
+struct ScanModule {
+    char name[SCAN_MODULE_NAME_SIZE]; // file name of the module's path, from the start of its rodata
+    u8 build_id[0x20];
+};
+
+// what scanning a title cost, logged so that the effect of adding a title can be seen
+struct ScanStats {
+    bool found; // the title's process was found
+    u32 regions; // code regions scanned
+    u32 modules; // loaded modules identified, only done when a pattern names a module
+    u32 queries; // Target::query() calls
+    u32 reads; // Target::read() calls
+    u64 bytes_read;
+    u64 ticks; // time spent scanning the title
+    bool timed_out; // the scan was stopped by the title or scan budget
+};
+
+// the result of a pattern, the only part of it that's written to
+struct PatternResult {
+    u64 addr{}; // where the patch was applied
+    u64 ticks{}; // when the result was known
+    PatchedResult result{PatchedResult::NOT_FOUND};
+    u8 match_count{}; // places that matched (and passed cond / applied)
+    bool cached{}; // restored from the previous run, checked before it's trusted
+};
+
+// where a pattern matched, kept until the whole title has been scanned in match all mode
+struct PatternMatch {
+    u64 patch_addr;
+    u32 inst;
+};
+
+// a bucketed pattern, the scan loop only reads this and Scanner::done
+struct ScanEntry {
+    PatternData pattern;
+    u8 index; // into Scanner::patterns
+};
+
+// the patterns being searched for in a title, bucketed by the first byte of their anchor.
+// every byte of memory is looked at once, and only the patterns whose anchor starts
+// with that byte are compared, so adding patterns adds (almost) nothing to the scan.
+// patterns with a parent aren't bucketed, they're searched for around each parent match.
+struct Scanner {
+    std::span<const Patterns> patterns;
+    std::span<PatternResult> results;
+    u8 bucket_start[0x101]; // patterns with anchor byte b are bucket[bucket_start[b]..bucket_start[b+1]]
+    ScanEntry bucket[SCAN_MAX_PATTERNS];
+    bool done[SCAN_MAX_PATTERNS]; // found as many times as expected, never set in match all mode
+    u8 parent[SCAN_MAX_PATTERNS]; // index of the parent pattern, NO_PARENT if scanned normally
+    bool active[SCAN_MAX_PATTERNS]; // being searched for
+    bool has_children[SCAN_MAX_PATTERNS];
+    bool match_all; // patch once the whole title has been scanned, only if every pattern matched as expected
+    u32 remaining; // patterns still being searched for, the scan stops at 0
+    u32 module_patterns; // active patterns that are searched for in a module
+    u32 max_size; // longest pattern in the buckets, reads overlap by this much so that patterns can't be split between them
+    u64 region_addr; // memory region being scanned, windows are kept within it, set by the caller
+    u64 region_end;
+    u8* window_buffer; // WINDOW_BUFFER_SIZE, the windows of chained patterns are read into this
+    ScanStats* stats; // the reads made while matching are counted in this, set by scanner_scan_regions()
+    PatternMatch matches[SCAN_MAX_PATTERNS][PATTERN_MAX_MATCHES];
+
+    static constexpr u8 NO_PARENT = 0xFF;
+};
+
+static_assert(SCAN_MAX_PATTERNS < Scanner::NO_PARENT);
+
+template<typename Target>
+void apply_match(Target& target, const Patterns& p, PatternResult& r, u64 patch_addr, u32 inst) {
+    if (INST_CONDS[(u8)p.cond].matches(inst)) {
+        const auto& patch = INST_PATCHES[(u8)p.patch];
+        const auto patch_data = patch.apply(inst);
+
+        // todo: log failed writes, although this should in theory never fail
+        if (!target.write(&patch_data, patch_addr, patch.size)) {
+            r.result = PatchedResult::FAILED_WRITE;
+        } else if (r.result != PatchedResult::FAILED_WRITE) {
+            r.result = PatchedResult::PATCHED_SYSPATCH;
+        }
+    } else if (r.result == PatchedResult::NOT_FOUND) {
+        // patch already applied by sigpatches
+        r.result = PatchedResult::PATCHED_FILE;
+    }
+
+    if (!r.addr) {
+        r.addr = patch_addr;
+    }
+    r.ticks = target.ticks();
+}
+
+// the build id matches if id is at least SCAN_MODULE_MIN_BUILD_ID hex digits and is the start of it
+inline auto scanner_module_matches(const ScanModule& module, const char* id) -> bool {
+    if (!std::strncmp(module.name, id, sizeof(module.name))) {
+        return true;
+    }
+
+    u32 n = 0;
+    for (; id[n]; n++) {
+        const auto c = id[n];
+        const u32 nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0x10;
+        const auto byte = module.build_id[n / 2];
+        if (n >= sizeof(module.build_id) * 2 || nibble != (n % 2 ? byte & 0xF : byte >> 4)) {
+            return false;
+        }
+    }
+    return n >= SCAN_MODULE_MIN_BUILD_ID;
+}
+
+// buckets the patterns that are still being searched for in module (nullptr for the title's
+// own code), only they're compared until it's called again. returns how many there are.
+inline auto scanner_select(Scanner& s, const ScanModule* module) -> u32 {
+    u8 count[0x100]{};
+    u32 selected{};
+    bool in_bucket[SCAN_MAX_PATTERNS]{};
+    s.max_size = 0;
+
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        const auto& p = s.patterns[i];
+        const auto& bp = p.byte_pattern;
+        if (!s.active[i] || s.done[i] || s.parent[i] != Scanner::NO_PARENT) {
+            continue;
+        }
+        if (module ? !p.module || !scanner_module_matches(*module, p.module) : p.module != nullptr) {
+            continue;
+        }
+
+        in_bucket[i] = true;
+        selected++;
+        count[bp.value[bp.anchor_offset]]++;
+        s.max_size = std::max<u32>(s.max_size, bp.size);
+    }
+
+    // counting sort of the patterns into their buckets
+    s.bucket_start[0] = 0;
+    for (u32 b = 0; b < 0x100; b++) {
+        s.bucket_start[b + 1] = s.bucket_start[b] + count[b];
+        count[b] = s.bucket_start[b];
+    }
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        const auto& bp = s.patterns[i].byte_pattern;
+        if (in_bucket[i]) {
+            s.bucket[count[bp.value[bp.anchor_offset]]++] = { bp, (u8)i };
+        }
+    }
+
+    return selected;
+}
+
+// the patterns in the buckets that are still being searched for
+inline auto scanner_selected(const Scanner& s) -> u32 {
+    u32 count{};
+    for (u32 k = 0; k < s.bucket_start[0x100]; k++) {
+        count += !s.done[s.bucket[k].index];
+    }
+    return count;
+}
+
+// returns the number of patterns to search for, the patterns of the title's own code are selected.
+// only patterns whose result is NOT_FOUND are searched for, so those limited to
+// another version are marked SKIPPED by the caller beforehand.
+inline auto scanner_init(Scanner& s, std::span<const Patterns> patterns, std::span<PatternResult> results, bool match_all) -> u32 {
+    auto& active = s.active;
+
+    s.patterns = patterns.first(std::min<size_t>(patterns.size(), SCAN_MAX_PATTERNS));
+    s.results = results.first(s.patterns.size());
+    s.remaining = 0;
+    s.module_patterns = 0;
+    s.match_all = match_all;
+    s.stats = nullptr;
+
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        const auto& p = s.patterns[i];
+        auto& r = s.results[i];
+        s.parent[i] = Scanner::NO_PARENT;
+        s.has_children[i] = false;
+        s.done[i] = false;
+        active[i] = false;
+
+        // skipped, or already patched on a rescan
+        if (r.result != PatchedResult::NOT_FOUND) {
+            continue;
+        }
+
+        // patterns without an anchor are rejected by pattern_parse() and the database checks
+        active[i] = p.expected_count;
+        s.remaining += active[i];
+        s.module_patterns += active[i] && p.module;
+    }
+
+    // if the parent isn't being searched for, the pattern is scanned for normally.
+    // only one level is supported, a pattern with a parent can't be a parent, and
+    // they have to be in the same module.
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        const auto& p = s.patterns[i];
+        if (!active[i] || !p.parent) {
+            continue;
+        }
+
+        for (u32 j = 0; j < s.patterns.size(); j++) {
+            const auto& parent = s.patterns[j];
+            if (j != i && active[j] && !parent.parent && !std::strcmp(parent.patch_name, p.parent) &&
+                (parent.module && p.module ? !std::strcmp(parent.module, p.module) : parent.module == p.module)) {
+                s.parent[i] = j;
+                s.has_children[j] = true;
+                break;
+            }
+        }
+    }
+
+    scanner_select(s, nullptr);
+    return s.remaining;
+}
+
+// the start of an nro, as it's mapped by ro
+struct ScanNroStart {
+    u32 unused;
+    u32 mod_offset;
+    u64 padding;
+    u32 magic; // "NRO0"
+    u32 version;
+    u32 size;
+    u32 flags;
+    u32 segments[3][2]; // offset / size of text, rodata and data
+    u32 bss_size;
+    u32 reserved;
+    u8 build_id[0x20];
+};
+
+// rodata starts with the path the module was built as
+struct ScanModulePath {
+    u32 zero;
+    u32 length;
+    char path[SCAN_MODULE_NAME_SIZE * 2];
+};
+
+// identifies the module whose text starts region, returns false if it isn't an nro.
+// buffer is at least sizeof(ScanModulePath).
+template<typename Target>
+auto scanner_identify(Target& target, ScanStats& stats, const ScanRegion& region, ScanModule& out, u8* buffer) -> bool {
+    ScanNroStart start{};
+    if (region.size < sizeof(start)) {
+        return false;
+    }
+    stats.reads++;
+    if (!target.read(&start, region.addr, sizeof(start)) || start.magic != 0x304F524E) { // "NRO0"
+        return false;
+    }
+    stats.bytes_read += sizeof(start);
+    stats.modules++;
+    out = {};
+    std::memcpy(out.build_id, start.build_id, sizeof(out.build_id));
+
+    // the name is optional, the build id is enough to identify it
+    const auto path = (ScanModulePath*)buffer;
+    if (start.segments[1][1] < sizeof(*path)) {
+        return true;
+    }
+    stats.reads++;
+    if (!target.read(path, region.addr + start.segments[1][0], sizeof(*path))) {
+        return true;
+    }
+    stats.bytes_read += sizeof(*path);
+    if (path->zero || !path->length) {
+        return true;
+    }
+
+    // only the file name is kept, eg nnfoo.nro from D:/home/build/nnfoo.nro
+    const auto length = std::min<u32>(path->length, sizeof(path->path));
+    u32 name_start = 0;
+    for (u32 i = 0; i < length && path->path[i]; i++) {
+        if (path->path[i] == '/' || path->path[i] == '\\') {
+            name_start = i + 1;
+        }
+    }
+    std::strncpy(out.name, path->path + name_start, std::min<u32>(length - name_start, sizeof(out.name) - 1));
+    return true;
+}
+
+template<typename Target>
+void scanner_scan_children(Scanner& s, Target& target, u32 parent, u64 parent_addr);
+
+// a read made while matching, counted in the stats (if any) as scanner_scan_regions() counts its own
+template<typename Target>
+auto scanner_read(Scanner& s, Target& target, void* out, u64 addr, u64 size) -> bool {
+    if (s.stats) {
+        s.stats->reads++;
+    }
+    if (!target.read(out, addr, size)) {
+        return false;
+    }
+    if (s.stats) {
+        s.stats->bytes_read += size;
+    }
+    return true;
+}
+
+// handles pattern index matching at data[i], where data was read from addr
+template<typename Target>
+void scanner_match(Scanner& s, Target& target, std::span<const u8> data, u32 i, u64 addr, u32 index) {
+    const auto& p = s.patterns[index];
+    auto& r = s.results[index];
+
+    // fetch the instruction, it may be outside of the buffer
+    u32 inst{};
+    const s64 inst_offset = (s64)i + p.inst_offset;
+    if (inst_offset >= 0 && inst_offset + sizeof(inst) <= data.size()) {
+        std::memcpy(&inst, data.data() + inst_offset, sizeof(inst));
+    } else if (!scanner_read(s, target, &inst, addr + inst_offset, sizeof(inst))) {
+        return;
+    }
+
+    // check if the instruction is the one that we want
+    if (!INST_CONDS[(u8)p.cond].matches(inst) && !INST_APPLIED[(u8)p.applied].matches(inst)) {
+        return;
+    }
+
+    const auto patch_addr = addr + inst_offset + p.patch_offset;
+
+    // in match all mode, the patch is only applied once the whole title has been
+    // scanned and the pattern is known to have matched the expected number of times
+    if (s.match_all) {
+        // the windows of two parent matches can overlap
+        for (u32 n = 0; n < std::min<u32>(r.match_count, PATTERN_MAX_MATCHES); n++) {
+            if (s.matches[index][n].patch_addr == patch_addr) {
+                return;
+            }
+        }
+        if (r.match_count < PATTERN_MAX_MATCHES) {
+            s.matches[index][r.match_count] = { patch_addr, inst };
+        }
+        if (r.match_count < 0xFF) {
+            r.match_count++;
+        }
+    } else {
+        r.match_count++;
+        apply_match(target, p, r, patch_addr, inst);
+        if (r.match_count == p.expected_count) {
+            s.done[index] = true;
+            s.remaining--;
+        }
+    }
+
+    if (s.has_children[index]) {
+        scanner_scan_children(s, target, index, addr + i);
+
+        // every window of the parent has been searched, the children that weren't in
+        // them can't be found, so they mustn't keep the scan going (they stay NOT_FOUND)
+        if (s.done[index]) {
+            for (u32 c = 0; c < s.patterns.size(); c++) {
+                if (s.parent[c] == index && !s.done[c]) {
+                    s.done[c] = true;
+                    s.remaining--;
+                }
+            }
+        }
+    }
+}
+
+// searches for the children of a pattern in the window around where the parent matched
+template<typename Target>
+void scanner_scan_children(Scanner& s, Target& target, u32 parent, u64 parent_addr) {
+    const auto buffer = s.window_buffer;
+
+    for (u32 c = 0; c < s.patterns.size(); c++) {
+        const auto& p = s.patterns[c];
+        const auto& bp = p.byte_pattern;
+        if (s.parent[c] != parent || s.done[c]) {
+            continue;
+        }
+
+        const u64 window = std::min<u32>(p.window, PATTERN_MAX_WINDOW);
+        const auto start = parent_addr - std::min(window, parent_addr - s.region_addr);
+        const auto end = std::min(parent_addr + window + bp.size, s.region_end);
+        if (end <= start || !scanner_read(s, target, buffer, start, end - start)) {
+            continue;
+        }
+
+        const std::span<const u8> data{buffer, end - start};
+        for (u32 i = 0; i + bp.size <= data.size(); i++) {
+            if (bp.matches(data.data() + i)) {
+                scanner_match(s, target, data, i, start, c);
+                if (s.done[c]) {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// scans data for every pattern in a single pass.
+// only matches starting before scan_size are handled, the rest of data is overlap.
+template<typename Target>
+void scanner_scan(Scanner& s, Target& target, std::span<const u8> data, u32 scan_size, u64 addr) {
+    for (u32 j = 0; j < data.size() && s.remaining; j++) {
+        const auto b = data[j];
+        for (u32 k = s.bucket_start[b]; k < s.bucket_start[b + 1]; k++) {
+            const auto& e = s.bucket[k];
+            const auto& bp = e.pattern;
+
+            // already found as many times as expected
+            if (s.done[e.index]) {
+                continue;
+            }
+
+            // j is the anchor, i is the start of the pattern
+            if (j < bp.anchor_offset) {
+                continue;
+            }
+            const u32 i = j - bp.anchor_offset;
+            if (i >= scan_size || i + bp.size > data.size() || !bp.matches(data.data() + i)) {
+                continue;
+            }
+
+            scanner_match(s, target, data, i, addr, e.index);
+        }
+    }
+}
+
+// called instead of scanner_finish() when the scan is stopped early. the patterns that
+// weren't found are marked TIMED_OUT, as are those matched in match all mode, as the
+// rest of the title could have had more matches.
+template<typename Target>
+void scanner_time_out(Scanner& s, Target& target) {
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        auto& r = s.results[i];
+        if (s.active[i] && r.result == PatchedResult::NOT_FOUND) {
+            r.result = PatchedResult::TIMED_OUT;
+            r.ticks = target.ticks();
+        }
+    }
+}
+
+// applies the patches found in match all mode
+template<typename Target>
+void scanner_finish(Scanner& s, Target& target) {
+    if (!s.match_all) {
+        return;
+    }
+
+    for (u32 i = 0; i < s.patterns.size(); i++) {
+        const auto& p = s.patterns[i];
+        auto& r = s.results[i];
+        if (!s.active[i] || !r.match_count) {
+            continue;
+        }
+
+        if (r.match_count != p.expected_count || r.match_count > PATTERN_MAX_MATCHES) {
+            // don't patch blindly, any of the matches could be the wrong one
+            r.result = PatchedResult::AMBIGUOUS;
+            r.addr = s.matches[i][0].patch_addr;
+            r.ticks = target.ticks();
+            continue;
+        }
+
+        for (u32 n = 0; n < r.match_count; n++) {
+            apply_match(target, p, r, s.matches[i][n].patch_addr, s.matches[i][n].inst);
+        }
+    }
+}
+
+// scans the code regions of a process, reading buffer_size at a time, until every pattern
+// has been found (unless in match all mode) or deadline (in target ticks) has passed.
+// a loaded module is only identified if a pattern names a module, and only read if one names it.
+template<typename Target>
+void scanner_scan_regions(Scanner& s, Target& target, ScanStats& stats, u8* buffer, u64 buffer_size, u64 deadline) {
+    ScanRegion region{};
+    ScanModule module{};
+    u64 addr{};
+    bool in_module{}; // the selected patterns are a module's
+
+    s.stats = &stats;
+    while (s.remaining && !stats.timed_out) {
+        stats.queries++;
+        if (!target.query(addr, region)) {
+            break;
+        }
+        addr = region.addr + region.size;
+
+        // if addr=0 then we hit the reserved memory section
+        if (!addr) {
+            break;
+        }
+        // skip memory that we don't want
+        if (!region.size || !region.code) {
+            continue;
+        }
+
+        // the selection only changes when going between the title's code and a module
+        if (region.code == ScanCode_Module) {
+            if (!s.module_patterns || !scanner_identify(target, stats, region, module, buffer)) {
+                continue;
+            }
+            scanner_select(s, &module);
+            in_module = true;
+        } else if (in_module) {
+            scanner_select(s, nullptr);
+            in_module = false;
+        }
+        // everything that could be in here has been found
+        if (!scanner_selected(s)) {
+            continue;
+        }
+
+        // reads overlap by the longest pattern, so a pattern split between two
+        // reads is still found (in the read that it starts in)
+        const auto step_size = buffer_size - s.max_size;
+        s.region_addr = region.addr;
+        s.region_end = region.addr + region.size;
+        stats.regions++;
+        for (u64 sz = 0; sz < region.size && s.remaining && (!s.module_patterns || scanner_selected(s)); sz += step_size) {
+            // checked once per read, which is the most a pattern can slow a scan down by
+            if (target.ticks() >= deadline) {
+                stats.timed_out = true;
+                break;
+            }
+
+            const auto actual_size = std::min(buffer_size, region.size - sz);
+            stats.reads++;
+            if (!target.read(buffer, region.addr + sz, actual_size)) {
+                // todo: log failed reads!
+                break;
+            } else {
+                stats.bytes_read += actual_size;
+                scanner_scan(s, target, std::span{buffer, actual_size}, std::min(step_size, actual_size), region.addr + sz);
+            }
+        }
+    }
+
+    if (stats.timed_out) {
+        scanner_time_out(s, target);
+    } else {
+        scanner_finish(s, target);
+    }
+}
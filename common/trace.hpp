@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef> // for offsetof
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+// a capture of every svc the scan made, so that a console's scan can be replayed on a pc
+// (see tools/src/trace-replay.cpp). creating TRACE_REQUEST_PATH captures the next boot.
+//
+// layout: TraceHeader, then TraceEvents in the order the svcs were made.
+// a READ or WRITE that succeeded is followed by its size bytes of data.
+constexpr auto TRACE_PATH = "/config/sys-patch/trace.bin";
+// removed once the whole trace has been written, so only one boot is captured (a failed one is retried)
+constexpr auto TRACE_REQUEST_PATH = "/config/sys-patch/capture";
+constexpr u32 TRACE_MAGIC = 0x54505953; // "SYPT"
+constexpr u16 TRACE_VERSION = 1;
+
+enum class TraceEventType : u8 {
+    ATTACH, // addr: the title id, size: the title's index into the patches
+    QUERY, // addr / size: the region, as returned
+    READ,
+    WRITE,
+    DETACH, // ticks: spent on the title, from attaching (truncated to 32 bits)
+};
+
+struct TraceHeader {
+    u32 magic; // TRACE_MAGIC
+    u16 version; // TRACE_VERSION
+    u16 header_size; // sizeof(TraceHeader)
+    u16 event_size; // sizeof(TraceEvent)
+    u8 match_all;
+    u8 pattern_db; // the patterns came from the pattern database
+    u32 fw_version; // MAKEHOSVERSION format
+    u32 ams_version;
+    u32 read_buffer_size; // READ_BUFFER_SIZE of the sysmod
+    u64 tick_frequency; // of the ticks in the events
+    char syspatch_version[32]; // VERSION_WITH_HASH of the sysmod that captured it
+};
+
+struct TraceEvent {
+    TraceEventType type;
+    u8 ok; // the svc succeeded
+    u8 code; // QUERY: ScanCode, what the region holds
+    u8 reserved;
+    u32 ticks; // how long the svc took
+    u64 addr;
+    u64 size;
+    u32 mem_type; // QUERY: MemoryInfo::type
+    u32 mem_perm; // QUERY: MemoryInfo::perm
+};
+
+static_assert(sizeof(TraceHeader) == 64 && offsetof(TraceHeader, syspatch_version) == 32);
+static_assert(sizeof(TraceEvent) == 32);
+
+// returns the header if data starts with a trace header, nullptr otherwise.
+// the events are checked as they're read, a capture cut short is still usable.
+inline auto trace_validate(const void* data, u64 size) -> const TraceHeader* {
+    const auto header = (const TraceHeader*)data;
+    if (size < sizeof(TraceHeader) || header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+        return nullptr;
+    }
+    if (header->header_size < sizeof(TraceHeader) || header->event_size < sizeof(TraceEvent) || size < header->header_size) {
+        return nullptr;
+    }
+    return header;
+}
@@ -1,69 +1,353 @@
 #define TESLA_INIT_IMPL // If you have more than one file using the tesla header, only define this in the main one
 #define STBTT_STATIC
 #include <tesla.hpp>    // The Tesla Header
+#include <atomic>
 #include <string_view>
+#include <vector>
 #include "minIni/minIni.h"
+#include "config.hpp"
 
 namespace {
 
-constexpr auto CONFIG_PATH = "/config/sys-patch/config.ini";
-constexpr auto LOG_PATH = "/config/sys-patch/log.ini";
+// size + last modified time, used to tell if a file changed since it was last read
+struct FileStamp {
+    s64 size{-1}; // -1 if the file doesn't exist
+    u64 modified{};
 
-auto does_file_exist(const char* path) -> bool {
-    Result rc{};
-    FsFileSystem fs{};
+    auto operator==(const FileStamp&) const -> bool = default;
+};
+
+auto get_file_stamp(const char* path) -> FileStamp {
+    FileStamp stamp{};
     FsFile file{};
+    FsTimeStampRaw timestamp{};
     char path_buf[FS_MAX_PATH]{};
+    // shares the sd card session with minIni
+    auto fs = ini_fs_get();
 
-    if (R_FAILED(fsOpenSdCardFileSystem(&fs))) {
-        return false;
+    if (!fs) {
+        return stamp;
     }
 
     strcpy(path_buf, path);
-    rc = fsFsOpenFile(&fs, path_buf, FsOpenMode_Read, &file);
-    fsFileClose(&file);
-    fsFsClose(&fs);
-    return R_SUCCEEDED(rc);
+    if (R_SUCCEEDED(fsFsOpenFile(fs, path_buf, FsOpenMode_Read, &file))) {
+        if (R_FAILED(fsFileGetSize(&file, &stamp.size))) {
+            stamp.size = -1;
+        }
+        fsFileClose(&file);
+    }
+    if (stamp.size >= 0 && R_SUCCEEDED(fsFsGetFileTimeStampRaw(fs, path_buf, &timestamp)) && timestamp.is_valid) {
+        stamp.modified = timestamp.modified;
+    }
+    return stamp;
 }
 
 // creates a directory, non-recursive!
 auto create_dir(const char* path) -> bool {
-    Result rc{};
-    FsFileSystem fs{};
     char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
 
-    if (R_FAILED(fsOpenSdCardFileSystem(&fs))) {
+    if (!fs) {
         return false;
     }
 
     strcpy(path_buf, path);
-    rc = fsFsCreateDirectory(&fs, path_buf);
-    fsFsClose(&fs);
-    return R_SUCCEEDED(rc);
+    return R_SUCCEEDED(fsFsCreateDirectory(fs, path_buf));
 }
 
-struct ConfigEntry {
-    const char* const section;
-    const char* const key;
-    bool value;
+// only needed before the first write, the sysmod creates these on boot
+void create_config_dir() {
+    static bool created{};
+    if (!created) {
+        create_dir("/config/");
+        create_dir("/config/sys-patch/");
+        created = true;
+    }
+}
 
-    ConfigEntry(const char* _section, const char* _key, bool default_value) :
-        section{_section}, key{_key}, value{default_value} {}
+// how long after the last toggle the config is written
+constexpr u64 CONFIG_SAVE_DELAY_NS = 1'000'000'000;
 
-    void load_value_from_ini() {
-        this->value = ini_getbool(this->section, this->key, this->value, CONFIG_PATH);
-    }
+// while a rescan runs, how often the log is checked and when to give up on it
+constexpr u64 RESCAN_POLL_NS = 250'000'000;
+constexpr u64 RESCAN_TIMEOUT_NS = 10'000'000'000;
+// a benchmark scans up to BENCHMARK_MAX_RUNS more times first
+constexpr u64 BENCHMARK_TIMEOUT_NS = 60'000'000'000;
+
+// toggles only change the config in memory, it's written out in one go
+// after CONFIG_SAVE_DELAY_NS, when the overlay is hidden or when it exits.
+Config config{};
+bool config_dirty{};
+u64 config_dirty_tick{};
+
+void config_save(const Config& config) {
+    static char buffer[0x400];
+    create_config_dir();
+    config_write(config, CONFIG_ALL_OPTIONS, buffer, sizeof(buffer));
+}
+
+struct ConfigEntry {
+    const ConfigOption& option;
+
+    ConfigEntry(bool Config::* value) :
+        option{config_option(value)} {}
 
     auto create_list_item(const char* text) {
-        auto item = new tsl::elm::ToggleListItem(text, value);
+        auto item = new tsl::elm::ToggleListItem(text, config.*option.value);
         item->setStateChangedListener([this](bool new_value){
-            this->value = new_value;
-            ini_putl(this->section, this->key, this->value, CONFIG_PATH);
+            config.*this->option.value = new_value;
+            config_dirty = true;
+            config_dirty_tick = armGetSystemTick();
         });
         return item;
     }
 };
 
+enum class LogColour : u8 {
+    SYSPATCH,
+    FILE,
+    UNPATCHED,
+    STATS,
+    TEXT,
+};
+
+struct LogRow {
+    std::string section; // set on the first row of each section
+    std::string key;
+    std::string value;
+    LogColour colour;
+};
+
+// log.ini and timing.ini parsed into the rows that are displayed.
+// they're only parsed again if the size or timestamp of either changed.
+struct LogModel {
+    FileStamp stamp{};
+    FileStamp timing_stamp{};
+    std::vector<LogRow> rows{};
+
+    // returns true if the rows changed
+    auto update() -> bool {
+        const auto new_stamp = get_file_stamp(LOG_PATH);
+        const auto new_timing_stamp = get_file_stamp(TIMING_PATH);
+        if (new_stamp == stamp && new_timing_stamp == timing_stamp) {
+            return false;
+        }
+
+        stamp = new_stamp;
+        timing_stamp = new_timing_stamp;
+        rows.clear();
+        if (stamp.size >= 0) {
+            browse(LOG_PATH);
+        }
+        if (timing_stamp.size >= 0) {
+            browse(TIMING_PATH);
+        }
+        return true;
+    }
+
+    void browse(const char* path) {
+        struct CallbackUser {
+            std::vector<LogRow>& rows;
+            std::string last_section;
+        } callback_userdata{rows};
+
+        ini_browse([](const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData){
+            auto user = (CallbackUser*)UserData;
+            std::string_view value{Value};
+
+            // the fingerprint is only there to tell if the log changed
+            if (value == "Skipped" || std::string_view{Key} == "fingerprint") {
+                return 1;
+            }
+
+            LogRow row{};
+            if (user->last_section != Section) {
+                user->last_section = Section;
+                row.section = Section;
+            }
+            row.key = Key;
+
+            if (value.starts_with("Patched")) {
+                row.value = "Patched";
+                row.colour = value.ends_with("(sys-patch)") ? LogColour::SYSPATCH : LogColour::FILE;
+            } else if (value.starts_with("Unpatched") || value.starts_with("Ambiguous") || value.starts_with("Timed out")) {
+                row.value = Value;
+                row.colour = LogColour::UNPATCHED;
+            } else {
+                row.value = Value;
+                const std::string_view section{Section};
+                row.colour = section == "stats" || section == "timing" || section == "benchmark" ? LogColour::STATS : LogColour::TEXT;
+            }
+
+            user->rows.emplace_back(std::move(row));
+            return 1;
+        }, &callback_userdata, path);
+    }
+
+    void add_to_list(tsl::elm::List* list) const {
+        #define F(x) ((x) >> 4) // 8bit -> 4bit
+        constexpr tsl::Color colour_syspatch{F(0), F(255), F(200), F(255)};
+        constexpr tsl::Color colour_file{F(255), F(177), F(66), F(255)};
+        constexpr tsl::Color colour_unpatched{F(250), F(90), F(58), F(255)};
+        #undef F
+
+        for (const auto& row : rows) {
+            if (!row.section.empty()) {
+                list->addItem(new tsl::elm::CategoryHeader("Log: " + row.section));
+            }
+
+            switch (row.colour) {
+                case LogColour::SYSPATCH: list->addItem(new tsl::elm::ListItem(row.key, row.value, colour_syspatch)); break;
+                case LogColour::FILE: list->addItem(new tsl::elm::ListItem(row.key, row.value, colour_file)); break;
+                case LogColour::UNPATCHED: list->addItem(new tsl::elm::ListItem(row.key, row.value, colour_unpatched)); break;
+                case LogColour::STATS: list->addItem(new tsl::elm::ListItem(row.key, row.value, tsl::style::color::ColorDescription)); break;
+                case LogColour::TEXT: list->addItem(new tsl::elm::ListItem(row.key, row.value, tsl::style::color::ColorText)); break;
+            }
+        }
+    }
+};
+
+// kept for the lifetime of the overlay, so that reopening it doesn't parse the log again
+LogModel log_model{};
+bool log_check_on_show{};
+bool pmshell_open{}; // opened in initServices(), needed to launch the sysmod again
+
+enum Job : u32 {
+    Job_LoadConfig = 1 << 0,
+    Job_LoadLog = 1 << 1,
+    Job_SaveConfig = 1 << 2,
+    Job_Rescan = 1 << 3,
+    Job_Benchmark = 1 << 4, // with Job_Rescan
+};
+
+// asks the sysmod to only retry what wasn't patched and starts it again, if benchmark
+// it first times scans that don't patch.
+// it exits once it's done, so it isn't running at this point.
+auto rescan(bool benchmark) -> bool {
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
+
+    if (!fs || !pmshell_open) {
+        return false;
+    }
+
+    create_config_dir();
+    strcpy(path_buf, RESCAN_PATH);
+    fsFsCreateFile(fs, path_buf, 0, 0);
+    if (benchmark) {
+        strcpy(path_buf, BENCHMARK_PATH);
+        fsFsCreateFile(fs, path_buf, 0, 0);
+    }
+
+    u64 pid{};
+    const NcmProgramLocation location{ .program_id = SYSPATCH_TITLE_ID, .storageID = NcmStorageId_None };
+    if (R_FAILED(pmshellLaunchProgram(0, &location, &pid))) {
+        // otherwise the next boot would rescan (and benchmark) before patching
+        strcpy(path_buf, RESCAN_PATH);
+        fsFsDeleteFile(fs, path_buf);
+        strcpy(path_buf, BENCHMARK_PATH);
+        fsFsDeleteFile(fs, path_buf);
+        return false;
+    }
+    return true;
+}
+
+// does all of the sd card io on a worker thread so that the ui thread never waits on it.
+// the ui thread polls done() every frame and only then reads config / log_model.
+struct Worker {
+    Thread thread{};
+    std::atomic<bool> finished{};
+    bool running{};
+    u32 jobs{};
+    bool log_changed{};
+    bool rescan_started{};
+    Config config{}; // loaded config, or a copy of the config to save
+
+    // returns false if the worker is still busy
+    auto start(u32 _jobs, const Config* save = nullptr) -> bool {
+        if (running) {
+            return false;
+        }
+
+        jobs = _jobs;
+        if (save) {
+            config = *save;
+        }
+        finished = false;
+        if (R_FAILED(threadCreate(&thread, thread_func, this, nullptr, 0x4000, 0x2C, -2))) {
+            // run it here instead, slow but correct
+            thread_func(this);
+            return true;
+        }
+        if (R_FAILED(threadStart(&thread))) {
+            threadClose(&thread);
+            thread_func(this);
+            return true;
+        }
+        running = true;
+        return true;
+    }
+
+    // returns the jobs that finished, once
+    auto done() -> u32 {
+        if (!finished.load(std::memory_order_acquire)) {
+            return 0;
+        }
+
+        wait();
+        finished = false;
+        return jobs;
+    }
+
+    void wait() {
+        if (running) {
+            threadWaitForExit(&thread);
+            threadClose(&thread);
+            running = false;
+        }
+    }
+
+    static void thread_func(void* arg) {
+        auto worker = (Worker*)arg;
+        if (worker->jobs & Job_SaveConfig) {
+            config_save(worker->config);
+        }
+        if (worker->jobs & Job_LoadConfig) {
+            config_load(worker->config);
+        }
+        if (worker->jobs & Job_Rescan) {
+            worker->rescan_started = rescan(worker->jobs & Job_Benchmark);
+        }
+        if (worker->jobs & Job_LoadLog) {
+            worker->log_changed = log_model.update();
+        }
+        worker->finished.store(true, std::memory_order_release);
+    }
+};
+
+Worker worker{};
+
+// writes the config now if it has any pending changes
+void config_flush() {
+    worker.wait();
+    if (config_dirty) {
+        config_dirty = false;
+        config_save(config);
+    }
+}
+
+#if defined SYS_PATCH_DEBUG
+// how long it took from opening the overlay to the first frame / to the loaded list
+void debug_log_open_latency(u64 open_tick, u64 first_frame_tick, u64 loaded_tick) {
+    static char buffer[0x200];
+    INI_BATCH batch{};
+    ini_batch_begin(&batch, buffer, sizeof(buffer), false, "/config/sys-patch/overlay_debug.ini");
+    ini_batch_putl(&batch, "open_latency", "first_frame_us", armTicksToNs(first_frame_tick - open_tick) / 1000);
+    ini_batch_putl(&batch, "open_latency", "loaded_us", armTicksToNs(loaded_tick - open_tick) / 1000);
+    ini_batch_commit(&batch);
+}
+#endif
+
 class GuiMain final : public tsl::Gui {
 public:
     GuiMain() { }
@@ -71,81 +355,175 @@ public:
     // Called when this Gui gets loaded to create the UI
     // Allocate all elements on the heap. libtesla will make sure to clean them up when not needed anymore
     tsl::elm::Element* createUI() override {
-        create_dir("/config/");
-        create_dir("/config/sys-patch/");
-
-        config_patch_sysmmc.load_value_from_ini();
-        config_patch_emummc.load_value_from_ini();
-        config_logging.load_value_from_ini();
-        config_version_skip.load_value_from_ini();
+        open_tick = armGetSystemTick();
 
         auto frame = new tsl::elm::OverlayFrame("sys-patch", VERSION_WITH_HASH);
-        auto list = new tsl::elm::List();
+        list = new tsl::elm::List();
 
+        // placeholders until the worker has loaded the config and log
         list->addItem(new tsl::elm::CategoryHeader("Options"));
-        list->addItem(config_patch_sysmmc.create_list_item("Patch sysMMC"));
-        list->addItem(config_patch_emummc.create_list_item("Patch emuMMC"));
-        list->addItem(config_logging.create_list_item("Logging"));
-        list->addItem(config_version_skip.create_list_item("Version skip"));
+        list->addItem(new tsl::elm::ListItem("Loading...", "", tsl::style::color::ColorDescription));
+        worker.start(Job_LoadConfig | Job_LoadLog);
+        log_check_on_show = false;
 
-        if (does_file_exist(LOG_PATH)) {
-            struct CallbackUser {
-                tsl::elm::List* list;
-                std::string last_section;
-            } callback_userdata{list};
+        frame->setContent(list);
+        return frame;
+    }
 
-            ini_browse([](const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData){
-                auto user = (CallbackUser*)UserData;
-                std::string_view value{Value};
+    void update() override {
+        if (!first_frame_tick) {
+            first_frame_tick = armGetSystemTick();
+        }
 
-                if (value == "Skipped") {
-                    return 1;
-                }
+        // the log may have been rewritten while the overlay was hidden
+        if (log_check_on_show && loaded && worker.start(Job_LoadLog)) {
+            log_check_on_show = false;
+        }
 
-                if (user->last_section != Section) {
-                    user->last_section = Section;
-                    user->list->addItem(new tsl::elm::CategoryHeader("Log: " + user->last_section));
-                }
+        // the sysmod rewrites the log once the rescan is done
+        if (rescan_tick) {
+            const auto now = armGetSystemTick();
+            const auto timeout = rescan_jobs & Job_Benchmark ? BENCHMARK_TIMEOUT_NS : RESCAN_TIMEOUT_NS;
+            if (armTicksToNs(now - rescan_tick) >= timeout) {
+                rescan_tick = 0;
+                rescan_status_item()->setValue("Timed out");
+            } else if (armTicksToNs(now - rescan_poll_tick) >= RESCAN_POLL_NS && worker.start(Job_LoadLog)) {
+                rescan_poll_tick = now;
+            }
+        }
 
-                #define F(x) ((x) >> 4) // 8bit -> 4bit
-                constexpr tsl::Color colour_syspatch{F(0), F(255), F(200), F(255)};
-                constexpr tsl::Color colour_file{F(255), F(177), F(66), F(255)};
-                constexpr tsl::Color colour_unpatched{F(250), F(90), F(58), F(255)};
-                #undef F
-
-                if (value.starts_with("Patched")) {
-                    if (value.ends_with("(sys-patch)")) {
-                        user->list->addItem(new tsl::elm::ListItem(Key, "Patched", colour_syspatch));
-                    } else {
-                        user->list->addItem(new tsl::elm::ListItem(Key, "Patched", colour_file));
-                    }
-                } else if (value.starts_with("Unpatched")) {
-                    user->list->addItem(new tsl::elm::ListItem(Key, Value, colour_unpatched));
-                } else if (user->last_section == "stats") {
-                    user->list->addItem(new tsl::elm::ListItem(Key, Value, tsl::style::color::ColorDescription));
-                } else {
-                    user->list->addItem(new tsl::elm::ListItem(Key, Value, tsl::style::color::ColorText));
-                }
+        // pending toggles are saved first, so that the rescan uses them
+        if (rescan_pending && worker.start(rescan_jobs | (config_dirty ? Job_SaveConfig : 0), &config)) {
+            rescan_pending = false;
+            config_dirty = false;
+        }
 
-                return 1;
-            }, &callback_userdata, LOG_PATH);
-        } else {
+        // the worker is only busy for a short while, so if it can't be started
+        // now the save is tried again on the next frame
+        if (config_dirty && armTicksToNs(armGetSystemTick() - config_dirty_tick) >= CONFIG_SAVE_DELAY_NS) {
+            if (worker.start(Job_SaveConfig, &config)) {
+                config_dirty = false;
+            }
+        }
 
+        const auto jobs = worker.done();
+        if (jobs & Job_Rescan) {
+            if (worker.rescan_started) {
+                rescan_tick = rescan_poll_tick = armGetSystemTick();
+            } else {
+                rescan_status_item()->setValue("Failed");
+            }
         }
 
-        frame->setContent(list);
-        return frame;
+        if (jobs & (Job_LoadConfig | Job_LoadLog)) {
+            if (loaded && worker.log_changed) {
+                rescan_tick = 0;
+            }
+
+            if (jobs & Job_LoadConfig) {
+                config = worker.config;
+            }
+
+            if (!loaded || worker.log_changed) {
+                // clear() frees the focused item, so focus moves to its replacement (or the
+                // top of the list) before the next frame uses it
+                tsl::elm::Element* focused = getFocusedElement();
+                const auto refocus_rescan = focused && focused == rescan_item;
+                const auto refocus_benchmark = focused && focused == benchmark_item;
+                list->clear();
+                populate_list();
+                if (focused) {
+                    focused = refocus_rescan ? rescan_item : refocus_benchmark ? benchmark_item : (tsl::elm::Element*)list;
+                    requestFocus(focused, tsl::FocusDirection::None);
+                }
+            }
+
+            #if defined SYS_PATCH_DEBUG
+            if (!loaded) {
+                debug_log_open_latency(open_tick, first_frame_tick, armGetSystemTick());
+            }
+            #endif
+            loaded = true;
+        }
     }
 
-    ConfigEntry config_patch_sysmmc{"options", "patch_sysmmc", true};
-    ConfigEntry config_patch_emummc{"options", "patch_emummc", true};
-    ConfigEntry config_logging{"options", "patch_logging", true};
-    ConfigEntry config_version_skip{"options", "version_skip", true};
+    void populate_list() {
+        list->addItem(new tsl::elm::CategoryHeader("Options"));
+        list->addItem(config_patch_sysmmc.create_list_item("Patch sysMMC"));
+        list->addItem(config_patch_emummc.create_list_item("Patch emuMMC"));
+        list->addItem(config_logging.create_list_item("Logging"));
+        list->addItem(config_version_skip.create_list_item("Version skip"));
+        list->addItem(config_match_all.create_list_item("Match all"));
+
+        // only one of them runs at a time, the one running shows that it is
+        const auto add_rescan_item = [this](tsl::elm::ListItem*& item, const char* text, u32 jobs) {
+            const auto running = (rescan_tick || rescan_pending) && rescan_jobs == jobs;
+            item = new tsl::elm::ListItem(text, running ? "Scanning..." : "");
+            item->setClickListener([this, item, jobs](u64 keys) -> bool {
+                if (!(keys & HidNpadButton_A) || rescan_tick || rescan_pending) {
+                    return false;
+                }
+                item->setValue("Scanning...");
+                rescan_jobs = jobs;
+                rescan_pending = true;
+                return true;
+            });
+            list->addItem(item);
+        };
+        add_rescan_item(rescan_item, "Rescan", Job_Rescan);
+        add_rescan_item(benchmark_item, "Benchmark", Job_Rescan | Job_Benchmark);
+
+        log_model.add_to_list(list);
+    }
+
+    tsl::elm::List* list{};
+    u64 open_tick{};
+    u64 first_frame_tick{};
+    bool loaded{};
+    auto rescan_status_item() -> tsl::elm::ListItem* {
+        return rescan_jobs & Job_Benchmark ? benchmark_item : rescan_item;
+    }
+
+    tsl::elm::ListItem* rescan_item{};
+    tsl::elm::ListItem* benchmark_item{};
+    u32 rescan_jobs{}; // of the last rescan, Job_Rescan and maybe Job_Benchmark
+    bool rescan_pending{}; // started once the worker is free
+    u64 rescan_tick{}; // when the sysmod was started, 0 if not waiting on it
+    u64 rescan_poll_tick{};
+    ConfigEntry config_patch_sysmmc{&Config::patch_sysmmc};
+    ConfigEntry config_patch_emummc{&Config::patch_emummc};
+    ConfigEntry config_logging{&Config::enable_logging};
+    ConfigEntry config_version_skip{&Config::version_skip};
+    ConfigEntry config_match_all{&Config::match_all};
 };
 
 // libtesla already initialized fs, hid, pl, pmdmnt, hid:sys and set:sys
 class SysPatchOverlay final : public tsl::Overlay {
 public:
+    // sm is only open while libtesla starts its services, so pm:shell is opened here for rescan()
+    void initServices() override {
+        tsl::hlp::doWithSmSession([] {
+            pmshell_open = R_SUCCEEDED(pmshellInitialize());
+        });
+    }
+
+    void exitServices() override {
+        config_flush();
+        ini_fs_exit();
+        if (pmshell_open) {
+            pmshellExit();
+            pmshell_open = false;
+        }
+    }
+
+    void onShow() override {
+        log_check_on_show = true;
+    }
+
+    void onHide() override {
+        config_flush();
+    }
+
     std::unique_ptr<tsl::Gui> loadInitialGui() override {
         return initially<GuiMain>();
     }
@@ -1,24 +1,68 @@
 #include <cstring>
 #include <span>
 #include <algorithm> // for std::min
-#include <bit> // for std::byteswap
 #include <utility> // std::unreachable
+#include <arm_acle.h> // for __crc32cd
 #include <switch.h>
 #include "minIni/minIni.h"
+#include "config.hpp"
+#include "results.hpp"
+#include "history.hpp"
+#include "trace.hpp"
+#include "pattern.hpp"
+#include "pattern_db.hpp"
+#include "inst.hpp"
+#include "scanner.hpp"
+#include "arena.hpp"
+#include "patches.hpp"
 
 namespace {
 
-constexpr u64 INNER_HEAP_SIZE = 0x1000; // Size of the inner heap (adjust as necessary).
-constexpr u64 READ_BUFFER_SIZE = 0x1000; // size of static buffer which memory is read into
-constexpr u32 FW_VER_ANY = 0x0;
-constexpr u16 REGEX_SKIP = 0x100;
 
-u32 FW_VERSION{}; // set on startup
-u32 AMS_VERSION{}; // set on startup
-u32 AMS_TARGET_VERSION{}; // set on startup
-u8 AMS_KEYGEN{}; // set on startup
-u64 AMS_HASH{}; // set on startup
+u32 FW_VERSION{}; // set by load_fw_version(), if needed
+u32 AMS_VERSION{}; // set by load_ams_version(), if needed
+u32 AMS_TARGET_VERSION{}; // set by load_ams_version(), if needed
+u8 AMS_KEYGEN{}; // set by load_ams_version(), if needed
+u64 AMS_HASH{}; // set by load_ams_version(), if needed
 bool VERSION_SKIP{}; // set on startup
+bool MATCH_ALL{}; // set on startup
+u64 PATCH_TICKS_START{}; // set before patching
+u64 TITLE_BUDGET_TICKS{}; // set on startup, 0 for no limit
+u64 SCAN_BUDGET_TICKS{}; // set on startup, 0 for no limit
+bool DRY_RUN{}; // set while benchmarking, writes are skipped (but succeed)
+u64 FIND_TICKS{}; // how long apply_patches() took to find the processes
+
+// how long each startup step took, 0 if it was skipped. logged under [init]
+struct InitStats {
+    u64 start; // when __appInit() was entered
+    u64 sm;
+    u64 fs;
+    u64 setsys;
+    u64 spl;
+    u64 config;
+    u64 pattern_db;
+};
+
+InitStats INIT{};
+
+// min / median / max of a phase over the benchmark runs, in ticks
+struct BenchTime {
+    u64 min;
+    u64 median;
+    u64 max;
+};
+
+// set by run_benchmark(), logged under [benchmark]
+struct BenchStats {
+    u32 runs; // 0 if it didn't run
+    BenchTime find; // walking the process list
+    BenchTime total; // the whole of apply_patches()
+    BenchTime titles[MAX_TITLES]; // scanning each title, if found
+    u64 bytes_read[MAX_TITLES]; // of each title, in the last run
+    bool found[MAX_TITLES];
+};
+
+BenchStats BENCH{};
 
 struct DebugEventInfo {
     u32 event_type;
@@ -31,395 +75,850 @@ struct DebugEventInfo {
     u8 _0x30[0x10];
 };
 
-struct PatternData {
-    constexpr PatternData(const char* s) {
-        // skip leading 0x (if any)
-        if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
-            s += 2;
-        }
+// what's been found in a title, TITLES[t] is for PATCHES[t]
+struct TitleState {
+    std::span<PatternResult> results; // one per pattern, in RESULTS
+    ScanStats stats;
+    u64 process_id; // set once attached, 0 if the title wasn't found
+    u64 code_addr; // start of the title's own code, set once attached
+    u64 cached_process_id; // of the results restored on a rescan, see verify_cached()
+    u64 cached_code_addr;
+};
 
-        // invalid string will cause a compile-time error due to no return
-        constexpr auto hexstr_2_nibble = [](char c) -> u8 {
-            if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
-            if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
-            if (c >= '0' && c <= '9') { return c - '0'; }
-        };
+static_assert(std::size(patches) <= MAX_TITLES);
+static_assert([] {
+    u32 count{};
+    for (const auto& patch : patches) {
+        count += patch.patterns.size();
+    }
+    return count;
+}() <= PATTERN_DB_MAX_PATTERNS, "RESULTS is too small for the built-in patterns");
+
+// filled from the pattern database, if one is loaded
+Patterns db_patterns[PATTERN_DB_MAX_PATTERNS]{};
+PatchEntry db_patches[MAX_TITLES]{};
+
+// the titles being patched, either the built-in table or the pattern database
+std::span<const PatchEntry> PATCHES{patches};
+
+// the only state written while patching, small enough to stay in cache
+PatternResult RESULTS[PATTERN_DB_MAX_PATTERNS]{};
+TitleState TITLES[MAX_TITLES]{};
+
+// gives each title its part of RESULTS, called once PATCHES is set
+void titles_init() {
+    u32 offset{};
+    for (u32 t = 0; t < PATCHES.size(); t++) {
+        TITLES[t].results = std::span{RESULTS + offset, PATCHES[t].patterns.size()};
+        offset += PATCHES[t].patterns.size();
+    }
+}
 
-        // parse and convert string
-        while (*s != '\0') {
-            if (*s == '.') {
-                data[size] = REGEX_SKIP;
-                s++;
-            } else {
-                data[size] |= hexstr_2_nibble(*s++) << 4;
-                data[size] |= hexstr_2_nibble(*s++) << 0;
+// true if any of the patterns being patched use the check
+auto patches_use_cond(CondId cond) -> bool {
+    for (const auto& patch : PATCHES) {
+        for (const auto& p : patch.patterns) {
+            if (p.cond == cond) {
+                return true;
             }
-            size++;
         }
     }
+    return false;
+}
 
-    // 32 is a reasonable max length for a byte pattern
-    // will compile-time error is size is too small
-    u16 data[32]{};
-    u8 size{};
-};
+// true if any of the patterns being patched are limited to an ams version
+auto patches_use_ams_version() -> bool {
+    for (const auto& patch : PATCHES) {
+        for (const auto& p : patch.patterns) {
+            if (p.min_ams_ver || p.max_ams_ver) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// set:sys and spl are only started if what's read from them is needed, see main().
+// both need the sm session, which is closed once main() knows what it needs.
+void load_fw_version() {
+    if (FW_VERSION) {
+        return;
+    }
 
-struct PatchData {
-    template<typename T>
-    constexpr PatchData(T _data) {
-        data = _data;
-        size = sizeof(T);
+    const auto start = armGetSystemTick();
+    if (R_SUCCEEDED(setsysInitialize())) {
+        SetSysFirmwareVersion fw{};
+        if (R_SUCCEEDED(setsysGetFirmwareVersion(&fw))) {
+            FW_VERSION = MAKEHOSVERSION(fw.major, fw.minor, fw.micro);
+            hosversionSet(FW_VERSION);
+        }
+        setsysExit();
     }
-    u64 data;
-    u8 size;
+    INIT.setsys = armGetSystemTick() - start;
+}
+
+void load_ams_version() {
+    const auto start = armGetSystemTick();
+    if (R_SUCCEEDED(splInitialize())) {
+        u64 v{};
+        u64 hash{};
+        if (R_SUCCEEDED(splGetConfig((SplConfigItem)65000, &v))) {
+            AMS_VERSION = (v >> 40) & 0xFFFFFF;
+            AMS_KEYGEN = (v >> 32) & 0xFF;
+            AMS_TARGET_VERSION = v & 0xFFFFFF;
+        }
+        if (R_SUCCEEDED(splGetConfig((SplConfigItem)65003, &hash))) {
+            AMS_HASH = hash;
+        }
+        splExit();
+    }
+    INIT.spl = armGetSystemTick() - start;
+}
+
+struct EmummcPaths {
+    char unk[0x80];
+    char nintendo[0x80];
 };
 
-enum class PatchedResult {
-    NOT_FOUND,
-    SKIPPED,
-    PATCHED_FILE,
-    PATCHED_SYSPATCH,
-    FAILED_WRITE,
+void smcAmsGetEmunandConfig(EmummcPaths* out_paths) {
+    SecmonArgs args{};
+    args.X[0] = 0xF0000404; /* smcAmsGetEmunandConfig */
+    args.X[1] = 0; /* EXO_EMUMMC_MMC_NAND*/
+    args.X[2] = (u64)out_paths; /* out path */
+    svcCallSecureMonitor(&args);
+}
+
+auto is_emummc() -> bool {
+    EmummcPaths paths{};
+    smcAmsGetEmunandConfig(&paths);
+    return (paths.unk[0] != '\0') || (paths.nintendo[0] != '\0');
+}
+
+// a process being patched, attached to with svcDebugActiveProcess(), see scanner.hpp
+// appends the svcs of the scan to TRACE_PATH, see trace.hpp.
+// the file is written as the scan goes, the time it takes isn't in the svc times.
+struct TraceWriter {
+    FsFile file;
+    u64 offset;
+    bool open;
+    bool active; // events are recorded
+
+    void append(const void* data, u64 size) {
+        if (active && R_FAILED(fsFileWrite(&file, offset, data, size, FsWriteOption_None))) {
+            // a trace with a gap can't be replayed, so it's cut short instead
+            active = false;
+        }
+        offset += size;
+    }
+
+    void event(const TraceEvent& event, const void* data = nullptr) {
+        append(&event, sizeof(event));
+        if (data) {
+            append(data, event.size);
+        }
+    }
 };
 
-struct Patterns {
-    const char* patch_name; // name of patch
-    const PatternData byte_pattern; // the pattern to search
+TraceWriter TRACE{};
 
-    const s32 inst_offset; // instruction offset relative to byte pattern
-    const s32 patch_offset; // patch offset relative to inst_offset
+struct DebugProcess {
+    Handle handle;
 
-    bool (*const cond)(u32 inst); // check condition of the instruction
-    PatchData (*const patch)(u32 inst); // the patch data to be applied
-    bool (*const applied)(u32 inst); // check to see if patch already applied
+    auto read(void* out, u64 addr, u64 size) -> bool {
+        if (!TRACE.active) {
+            return R_SUCCEEDED(svcReadDebugProcessMemory(out, handle, addr, size));
+        }
 
-    const u32 min_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
-    const u32 max_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
-    const u32 min_ams_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
-    const u32 max_ams_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+        const auto start = armGetSystemTick();
+        const auto ok = R_SUCCEEDED(svcReadDebugProcessMemory(out, handle, addr, size));
+        TRACE.event({ TraceEventType::READ, ok, 0, 0, (u32)(armGetSystemTick() - start), addr, size }, ok ? out : nullptr);
+        return ok;
+    }
 
-    PatchedResult result{PatchedResult::NOT_FOUND};
-};
+    auto write(const void* data, u64 addr, u64 size) -> bool {
+        if (DRY_RUN) {
+            return true;
+        }
+        if (!TRACE.active) {
+            return R_SUCCEEDED(svcWriteDebugProcessMemory(handle, data, addr, size));
+        }
+
+        const auto start = armGetSystemTick();
+        const auto ok = R_SUCCEEDED(svcWriteDebugProcessMemory(handle, data, addr, size));
+        TRACE.event({ TraceEventType::WRITE, ok, 0, 0, (u32)(armGetSystemTick() - start), addr, size }, ok ? data : nullptr);
+        return ok;
+    }
 
-struct PatchEntry {
-    const char* name; // name of the system title
-    const u64 title_id; // title id of the system title
-    const std::span<Patterns> patterns; // list of patterns to find
-    const u32 min_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
-    const u32 max_fw_ver{FW_VER_ANY}; // set to FW_VER_ANY to ignore
+    auto query(u64 addr, ScanRegion& out) -> bool {
+        MemoryInfo mem_info{};
+        u32 page_info{};
+        const auto start = armGetSystemTick();
+        const auto ok = R_SUCCEEDED(svcQueryDebugProcessMemory(&mem_info, &page_info, handle, addr));
+        out = { mem_info.addr, mem_info.size, ScanCode_None };
+        if ((mem_info.perm & Perm_Rx) == Perm_Rx) {
+            switch (mem_info.type & 0xFF) {
+                case MemType_CodeStatic: out.code = ScanCode_Static; break;
+                // nros mapped by ro, or code whose permissions were changed
+                case MemType_ModuleCodeStatic: case MemType_ModuleCodeMutable: case MemType_CodeMutable: out.code = ScanCode_Module; break;
+            }
+        }
+
+        if (TRACE.active) {
+            TRACE.event({ TraceEventType::QUERY, ok, out.code, 0, (u32)(armGetSystemTick() - start), out.addr, out.size, mem_info.type, mem_info.perm });
+        }
+        return ok;
+    }
+
+    auto ticks() -> u64 {
+        return armGetSystemTick();
+    }
 };
 
-constexpr auto subi_cond(u32 inst) -> bool {
-    // # Used on Atmosphère-NX 0.11.0 - 0.12.0.
-    const auto type = (inst >> 24) & 0xFF;
-    const auto imm = (inst >> 10) & 0xFFF;
-    return (type == 0x71) && (imm == 0x0A);
-}
+// see arena.hpp
+alignas(0x10) u8 ARENA_DATA[ARENA_SIZE];
+Arena ARENA{ARENA_DATA, sizeof(ARENA_DATA)};
 
-constexpr auto subr_cond(u32 inst) -> bool {
-    // # Used on Atmosphère-NX 0.13.0 and later.
-    const auto type = (inst >> 21) & 0x7F9;
-    const auto reg = (inst >> 16) & 0x1F;
-    return (type == 0x358) && (reg == 0x01);
+// scans the code of an attached process for the patterns of a title, until deadline (in ticks).
+// buffer is READ_BUFFER_SIZE.
+void scan_title(DebugProcess& process, ScanStats& stats, Scanner& scanner, u8* buffer, u64 deadline) {
+    const auto ticks_start = armGetSystemTick();
+    stats.found = true;
+    scanner_scan_regions(scanner, process, stats, buffer, READ_BUFFER_SIZE, deadline);
+    stats.ticks = armGetSystemTick() - ticks_start;
 }
 
-constexpr auto bl_cond(u32 inst) -> bool {
-    return ((inst >> 26) & 0x3F) == 0x25;
-}
+// marks the patterns limited to another version as skipped
+void skip_versions(const PatchEntry& patch, TitleState& title) {
+    if (!VERSION_SKIP) {
+        return;
+    }
 
-constexpr auto tbz_cond(u32 inst) -> bool {
-    return ((inst >> 24) & 0x7F) == 0x36;
+    for (u32 i = 0; i < patch.patterns.size(); i++) {
+        const auto& p = patch.patterns[i];
+        auto& r = title.results[i];
+        if (r.result == PatchedResult::NOT_FOUND &&
+            ((p.min_fw_ver && p.min_fw_ver > FW_VERSION) ||
+            (p.max_fw_ver && p.max_fw_ver < FW_VERSION) ||
+            (p.min_ams_ver && p.min_ams_ver > AMS_VERSION) ||
+            (p.max_ams_ver && p.max_ams_ver < AMS_VERSION))) {
+            r.result = PatchedResult::SKIPPED;
+        }
+    }
 }
 
-constexpr auto subs_cond(u32 inst) -> bool {
-    return subi_cond(inst) || subr_cond(inst);
+// the start of the title's own code, which moves with aslr, 0 if it has none
+auto code_start(DebugProcess& process) -> u64 {
+    ScanRegion region{};
+    for (u64 addr = 0; process.query(addr, region) && region.addr + region.size > addr; addr = region.addr + region.size) {
+        if (region.code == ScanCode_Static) {
+            return region.addr;
+        }
+    }
+    return 0;
 }
 
-constexpr auto cbz_cond(u32 inst) -> bool {
-    const auto type = inst >> 24;
-    return type == 0x34 || type == 0xB4;
-}
+// results restored from the previous run are kept if they're from the same process with
+// the same layout and the instruction is still patched, otherwise the pattern is searched
+// for again. a results file left from another boot is never trusted.
+void verify_cached(DebugProcess& process, const PatchEntry& patch, TitleState& title) {
+    const auto same_process = title.process_id == title.cached_process_id && title.code_addr && title.code_addr == title.cached_code_addr;
+    for (u32 i = 0; i < patch.patterns.size(); i++) {
+        const auto& p = patch.patterns[i];
+        auto& r = title.results[i];
+        if (!r.cached) {
+            continue;
+        }
 
-constexpr auto mov_cond(u32 inst) -> bool {
-    return ((inst >> 24) & 0x7F) == 0x52;
+        u32 inst{};
+        r.cached = false;
+        if (same_process && process.read(&inst, r.addr - p.patch_offset, sizeof(inst)) &&
+            INST_APPLIED[(u8)p.applied].matches(inst)) {
+            r.match_count = p.expected_count;
+        } else {
+            r.result = PatchedResult::NOT_FOUND;
+            r.addr = 0;
+        }
+    }
 }
 
-constexpr auto mov2_cond(u32 inst) -> bool {
-    if (hosversionBefore(15,0,0)) {
-        return (inst >> 24) == 0x92; // and x0, x19, #0xffffffff
-    } else {
-        return (inst >> 24) == 0x2A;
+// results restored from the previous run for a title that couldn't be attached to (or
+// wasn't found) can't be checked, so they aren't reported as this boot's
+void drop_cached(TitleState& title) {
+    for (auto& r : title.results) {
+        if (r.cached) {
+            r = {};
+        }
     }
 }
 
-constexpr auto bne_cond(u32 inst) -> bool {
-    const auto type = inst >> 24;
-    const auto cond = inst & 0x10;
-    return type == 0x54 || cond == 0x0;
+// titles with a lower priority are scanned first. ldr is waited on by every
+// process launch, so it goes first, then fs which everything else waits on.
+constexpr auto title_priority(u64 title_id) -> u32 {
+    switch (title_id) {
+        case 0x0100000000000001: return 0; // ldr
+        case 0x0100000000000000: return 1; // fs
+        default: return 2;
+    }
 }
 
-constexpr auto ret0_patch(u32 inst) -> PatchData {
-    return std::byteswap(0xE0031F2AU);
-}
+// finds the processes of every title in a single walk of the process list, then scans
+// them in order of priority, each within its own budget and what's left of the scan budget.
+// memory use is the same whatever the number of titles, as they share one scanner and
+// read buffer (freed on return).
+void apply_patches(std::span<const PatchEntry> patches) {
+    ArenaScope scope{ARENA};
+    u8* read_buffer{};
+    auto& scanner = arena_alloc_scan(ARENA, &read_buffer);
+    u64 pids[0x50]{};
+    s32 process_count{};
+    u32 remaining{};
+    bool pending[MAX_TITLES]{};
+    u64 title_pids[MAX_TITLES]{};
+    u32 order[MAX_TITLES]{};
+    const auto title_count = std::min<u32>(patches.size(), MAX_TITLES);
+    const auto scan_deadline = SCAN_BUDGET_TICKS ? armGetSystemTick() + SCAN_BUDGET_TICKS : UINT64_MAX;
 
-constexpr auto nop_patch(u32 inst) -> PatchData {
-    return std::byteswap(0x1F2003D5U);
-}
+    for (u32 t = 0; t < title_count; t++) {
+        const auto& patch = patches[t];
 
-constexpr auto subs_patch(u32 inst) -> PatchData {
-    return subi_cond(inst) ? (u8)0x1 : (u8)0x0;
-}
+        // skip if version isn't valid
+        if (VERSION_SKIP &&
+            ((patch.min_fw_ver && patch.min_fw_ver > FW_VERSION) ||
+            (patch.max_fw_ver && patch.max_fw_ver < FW_VERSION))) {
+            for (auto& r : TITLES[t].results) {
+                r.result = PatchedResult::SKIPPED;
+                r.cached = false;
+            }
+            continue;
+        }
 
-constexpr auto b_patch(u32 inst) -> PatchData {
-    const auto opcode = 0x14 << 24;
-    const auto offset = (inst >> 5) & 0x7FFFF;
-    return opcode | offset;
-}
+        pending[t] = true;
+        remaining++;
+    }
 
-constexpr auto mov0_patch(u32 inst) -> PatchData {
-    return std::byteswap(0xE0031FAAU);
+    const auto find_start = armGetSystemTick();
+    if (!remaining || R_FAILED(svcGetProcessList(&process_count, pids, 0x50))) {
+        for (u32 t = 0; t < title_count; t++) {
+            drop_cached(TITLES[t]);
+        }
+        return;
+    }
+
+    // the title of a process is only known once attached, so this only finds them.
+    // they're attached again to be scanned, so that no process is held while another is.
+    for (s32 i = 0; i < (process_count - 1) && remaining; i++) {
+        Handle handle{};
+        DebugEventInfo event_info{};
+
+        if (R_SUCCEEDED(svcDebugActiveProcess(&handle, pids[i])) &&
+            R_SUCCEEDED(svcGetDebugEvent(&event_info, handle))) {
+            for (u32 t = 0; t < title_count; t++) {
+                if (pending[t] && patches[t].title_id == event_info.title_id) {
+                    title_pids[t] = pids[i];
+                    pending[t] = false;
+                    remaining--;
+                    break;
+                }
+            }
+        }
+
+        if (handle) {
+            svcCloseHandle(handle);
+        }
+    }
+    FIND_TICKS = armGetSystemTick() - find_start;
+
+    // insertion sort, stable so that titles of the same priority keep the table's order
+    for (u32 t = 0; t < title_count; t++) {
+        u32 n = t;
+        for (; n > 0 && title_priority(patches[order[n - 1]].title_id) > title_priority(patches[t].title_id); n--) {
+            order[n] = order[n - 1];
+        }
+        order[n] = t;
+    }
+
+    for (u32 n = 0; n < title_count; n++) {
+        const auto t = order[n];
+        Handle handle{};
+        if (!title_pids[t] || R_FAILED(svcDebugActiveProcess(&handle, title_pids[t]))) {
+            drop_cached(TITLES[t]);
+            continue;
+        }
+
+        DebugProcess process{handle};
+        const auto attach_ticks = armGetSystemTick();
+        TRACE.event({ TraceEventType::ATTACH, 1, 0, 0, 0, patches[t].title_id, t });
+        TITLES[t].process_id = title_pids[t];
+        TITLES[t].code_addr = code_start(process);
+        verify_cached(process, patches[t], TITLES[t]);
+        skip_versions(patches[t], TITLES[t]);
+        if (scanner_init(scanner, patches[t].patterns, TITLES[t].results, MATCH_ALL)) {
+            const auto now = armGetSystemTick();
+            const auto deadline = TITLE_BUDGET_TICKS ? std::min(now + TITLE_BUDGET_TICKS, scan_deadline) : scan_deadline;
+            scan_title(process, TITLES[t].stats, scanner, read_buffer, deadline);
+        }
+        TRACE.event({ TraceEventType::DETACH, 1, 0, 0, (u32)(armGetSystemTick() - attach_ticks) });
+        svcCloseHandle(handle);
+    }
 }
 
-constexpr auto ret0_applied(u32 inst) -> bool {
-    return ret0_patch(inst).data == inst;
+// sorts the samples, there's at most BENCHMARK_MAX_RUNS of them
+auto bench_time(u64* samples, u32 count) -> BenchTime {
+    for (u32 i = 1; i < count; i++) {
+        const auto value = samples[i];
+        u32 n = i;
+        for (; n > 0 && samples[n - 1] > value; n--) {
+            samples[n] = samples[n - 1];
+        }
+        samples[n] = value;
+    }
+    return { samples[0], samples[count / 2], samples[count - 1] };
 }
 
-constexpr auto nop_applied(u32 inst) -> bool {
-    return nop_patch(inst).data == inst;
+// scans every title runs times without writing anything, timing each phase into BENCH.
+// each run scans everything, even on a rescan, the results from before are put back after.
+void run_benchmark(u32 runs) {
+    ArenaScope scope{ARENA};
+    const auto saved = ARENA.alloc<PatternResult>(std::size(RESULTS));
+    // samples[phase * BENCHMARK_MAX_RUNS + run], the phases are find, total then the titles
+    const auto samples = ARENA.alloc<u64>(BENCHMARK_SAMPLE_COUNT);
+    std::copy(std::begin(RESULTS), std::end(RESULTS), saved);
+    runs = std::min(runs, BENCHMARK_MAX_RUNS);
+
+    DRY_RUN = true;
+    for (u32 run = 0; run < runs; run++) {
+        std::fill(std::begin(RESULTS), std::end(RESULTS), PatternResult{});
+        for (auto& title : TITLES) {
+            title.stats = {};
+        }
+        FIND_TICKS = 0;
+
+        const auto start = armGetSystemTick();
+        apply_patches(PATCHES);
+        samples[run] = FIND_TICKS;
+        samples[BENCHMARK_MAX_RUNS + run] = armGetSystemTick() - start;
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            samples[(2 + t) * BENCHMARK_MAX_RUNS + run] = TITLES[t].stats.ticks;
+        }
+    }
+    DRY_RUN = false;
+
+    BENCH.runs = runs;
+    BENCH.find = bench_time(samples, runs);
+    BENCH.total = bench_time(samples + BENCHMARK_MAX_RUNS, runs);
+    for (u32 t = 0; t < PATCHES.size(); t++) {
+        BENCH.titles[t] = bench_time(samples + (2 + t) * BENCHMARK_MAX_RUNS, runs);
+        BENCH.bytes_read[t] = TITLES[t].stats.bytes_read;
+        BENCH.found[t] = TITLES[t].stats.found;
+    }
+
+    std::copy(saved, saved + std::size(RESULTS), RESULTS);
+    for (auto& title : TITLES) {
+        title.stats = {};
+    }
 }
 
-constexpr auto subs_applied(u32 inst) -> bool {
-    const auto type_i = (inst >> 24) & 0xFF;
-    const auto imm = (inst >> 10) & 0xFFF;
-    const auto type_r = (inst >> 21) & 0x7F9;
-    const auto reg = (inst >> 16) & 0x1F;
-    return ((type_i == 0x71) && (imm == 0x1)) || ((type_r == 0x358) && (reg == 0x0));
+// creates a directory, non-recursive!
+auto create_dir(const char* path) -> bool {
+    char path_buf[FS_MAX_PATH]{};
+    // shares the sd card session with minIni
+    auto fs = ini_fs_get();
+
+    if (!fs) {
+        return false;
+    }
+
+    strcpy(path_buf, path);
+    return R_SUCCEEDED(fsFsCreateDirectory(fs, path_buf));
 }
 
-constexpr auto b_applied(u32 inst) -> bool {
-    return 0x14 == (inst >> 24);
+// reads up to size bytes of the file with a single read
+auto read_file(const char* path, void* data, u64 size, u64* bytes_read) -> bool {
+    Result rc{};
+    FsFile file{};
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
+
+    if (!fs) {
+        return false;
+    }
+
+    strcpy(path_buf, path);
+    if (R_FAILED(rc = fsFsOpenFile(fs, path_buf, FsOpenMode_Read, &file))) {
+        return false;
+    }
+
+    rc = fsFileRead(&file, 0, data, size, FsReadOption_None, bytes_read);
+    fsFileClose(&file);
+    return R_SUCCEEDED(rc);
 }
 
-constexpr auto mov0_applied(u32 inst) -> bool {
-    return mov0_patch(inst).data == inst;
+// the size of a file, false if it can't be opened
+auto get_file_size(const char* path, s64* size) -> bool {
+    Result rc{};
+    FsFile file{};
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
+
+    if (!fs) {
+        return false;
+    }
+
+    strcpy(path_buf, path);
+    if (R_FAILED(rc = fsFsOpenFile(fs, path_buf, FsOpenMode_Read, &file))) {
+        return false;
+    }
+
+    rc = fsFileGetSize(&file, size);
+    fsFileClose(&file);
+    return R_SUCCEEDED(rc);
 }
 
-constinit Patterns fs_patterns[] = {
-    { "noacidsigchk1", "0xC8FE4739", -24, 0, bl_cond, ret0_patch, ret0_applied, FW_VER_ANY, MAKEHOSVERSION(9,2,0) },
-    { "noacidsigchk2", "0x0210911F000072", -5, 0, bl_cond, ret0_patch, ret0_applied, FW_VER_ANY, MAKEHOSVERSION(9,2,0) },
-    { "noncasigchk_old", "0x1E42B9", -5, 0, tbz_cond, nop_patch, nop_applied, MAKEHOSVERSION(10,0,0), MAKEHOSVERSION(14,2,1) },
-    { "noncasigchk_new", "0x3E4479", -5, 0, tbz_cond, nop_patch, nop_applied, MAKEHOSVERSION(15,0,0) },
-    { "nocntchk_old", "0x081C00121F05007181000054", -4, 0, bl_cond, ret0_patch, ret0_applied, MAKEHOSVERSION(10,0,0), MAKEHOSVERSION(14,2,1) },
-    { "nocntchk_new", "0x081C00121F05007141010054", -4, 0, bl_cond, ret0_patch, ret0_applied, MAKEHOSVERSION(15,0,0) },
+// why the pattern database was or wasn't used, logged as pattern_db under [stats]
+enum class PatternDbLoad : u8 {
+    LOADED,
+    MISSING,
+    TOO_LARGE, // over PATTERN_DB_MAX_SIZE
+    INVALID,
+    NO_FW, // no patterns for this fw
+    TOO_MANY, // over PATTERN_DB_MAX_PATTERNS patterns or MAX_TITLES titles for this fw
 };
 
-constinit Patterns ldr_patterns[] = {
-    { "noacidsigchk", "0xFD7BC6A8C0035FD6", 16, 2, subs_cond, subs_patch, subs_applied },
-};
+constexpr const char* PATTERN_DB_LOAD_NAMES[] = { "loaded", "missing", "too large", "invalid", "no patterns for this fw", "too many patterns or titles" };
 
-constinit Patterns es_patterns[] = {
-    { "es1", "0x1F90013128928052", -4, 0, cbz_cond, b_patch, b_applied, FW_VER_ANY, MAKEHOSVERSION(13,2,1) },
-    { "es2", "0xC07240F9E1930091", -4, 0, tbz_cond, nop_patch, nop_applied, FW_VER_ANY, MAKEHOSVERSION(10,2,0) },
-    { "es3", "0xF3031FAA02000014", -4, 0, bne_cond, nop_patch, nop_applied, FW_VER_ANY, MAKEHOSVERSION(10,2,0) },
-    { "es4", "0xC0FDFF35A8C35838", -4, 0, mov_cond, nop_patch, nop_applied, MAKEHOSVERSION(11,0,0), MAKEHOSVERSION(13,2,1) },
-    { "es5", "0xE023009145EEFF97", -4, 0, cbz_cond, b_patch, b_applied, MAKEHOSVERSION(11,0,0), MAKEHOSVERSION(13,2,1) },
-    { "es6", "0x.6300...0094A0..D1..FF97", 16, 0, mov2_cond, mov0_patch, mov0_applied, MAKEHOSVERSION(14,0,0) },
-};
+// loads the patterns for this fw from the pattern database into PATCHES.
+// on failure, the built-in patterns are used.
+// the file is read into the arena at its own size, and kept there on success.
+auto load_pattern_db() -> PatternDbLoad {
+    ArenaScope scope{ARENA};
+    s64 file_size{};
+    u64 size{};
 
-// NOTE: add system titles that you want to be patched to this table.
-// a list of system titles can be found here https://switchbrew.org/wiki/Title_list
-constinit PatchEntry patches[] = {
-    { "fs", 0x0100000000000000, fs_patterns },
-    // ldr needs to be patched in fw 10+
-    { "ldr", 0x0100000000000001, ldr_patterns, MAKEHOSVERSION(10,0,0) },
-    // es was added in fw 2
-    { "es", 0x0100000000000033, es_patterns, MAKEHOSVERSION(2,0,0) },
-};
+    if (!get_file_size(PATTERN_DB_PATH, &file_size)) {
+        return PatternDbLoad::MISSING;
+    }
+    if ((u64)file_size > PATTERN_DB_MAX_SIZE) {
+        return PatternDbLoad::TOO_LARGE;
+    }
 
-struct EmummcPaths {
-    char unk[0x80];
-    char nintendo[0x80];
-};
+    const auto buffer = (u8*)ARENA.alloc<u64>((file_size + sizeof(u64) - 1) / sizeof(u64));
+    if (!read_file(PATTERN_DB_PATH, buffer, file_size, &size)) {
+        return PatternDbLoad::MISSING;
+    }
 
-void smcAmsGetEmunandConfig(EmummcPaths* out_paths) {
-    SecmonArgs args{};
-    args.X[0] = 0xF0000404; /* smcAmsGetEmunandConfig */
-    args.X[1] = 0; /* EXO_EMUMMC_MMC_NAND*/
-    args.X[2] = (u64)out_paths; /* out path */
-    svcCallSecureMonitor(&args);
-}
+    const auto header = pattern_db_validate(buffer, size);
+    if (!header) {
+        return PatternDbLoad::INVALID;
+    }
 
-auto is_emummc() -> bool {
-    EmummcPaths paths{};
-    smcAmsGetEmunandConfig(&paths);
-    return (paths.unk[0] != '\0') || (paths.nintendo[0] != '\0');
-}
+    const auto titles = pattern_db_table<PatternDbTitle>(header, header->titles_offset);
+    const auto patterns = pattern_db_table<PatternDbPattern>(header, header->patterns_offset);
+    const auto index = pattern_db_table<u16>(header, header->index_offset);
+    const auto data = pattern_db_table<u8>(header, header->data_offset);
+
+    // with version skip, only the patterns for this fw are loaded (found with a binary search)
+    const u16* ids{};
+    u32 count = header->pattern_count;
+    if (VERSION_SKIP) {
+        const auto interval = pattern_db_find_interval(header, FW_VERSION);
+        if (!interval) {
+            return PatternDbLoad::NO_FW;
+        }
+        if (interval->first + interval->count > header->index_count) {
+            return PatternDbLoad::INVALID;
+        }
+        ids = index + interval->first;
+        count = interval->count;
+    }
 
-void patcher(Handle handle, std::span<const u8> data, u64 addr, std::span<Patterns> patterns) {
-    for (auto& p : patterns) {
-        // skip if version isn't valid
-        if (VERSION_SKIP &&
-            ((p.min_fw_ver && p.min_fw_ver > FW_VERSION) ||
-            (p.max_fw_ver && p.max_fw_ver < FW_VERSION) ||
-            (p.min_ams_ver && p.min_ams_ver > AMS_VERSION) ||
-            (p.max_ams_ver && p.max_ams_ver < AMS_VERSION))) {
-            p.result = PatchedResult::SKIPPED;
-            continue;
+    if (count > PATTERN_DB_MAX_PATTERNS) {
+        return PatternDbLoad::TOO_MANY;
+    }
+
+    u32 title_count{};
+    u32 last_title{};
+    for (u32 n = 0; n < count; n++) {
+        const u32 id = ids ? ids[n] : n;
+        if (id >= header->pattern_count) {
+            return PatternDbLoad::INVALID;
         }
 
-        // skip if already patched
-        if (p.result == PatchedResult::PATCHED_FILE || p.result == PatchedResult::PATCHED_SYSPATCH) {
-            continue;
+        const auto& src = patterns[id];
+        if (src.title >= header->title_count || (title_count && src.title < last_title) ||
+            !pattern_db_check_data(header, src, data) || !pattern_db_check_module(header, src, data) || src.name[sizeof(src.name) - 1] ||
+            src.cond >= CondId::COUNT || src.patch >= PatchId::COUNT || src.applied >= AppliedId::COUNT) {
+            return PatternDbLoad::INVALID;
         }
 
-        for (u32 i = 0; i < data.size(); i++) {
-            if (i + p.byte_pattern.size >= data.size()) {
-                break;
+        // patterns are grouped by title, so start a new entry when the title changes
+        if (!title_count || src.title != last_title) {
+            const auto& title = titles[src.title];
+            if (title_count == MAX_TITLES) {
+                return PatternDbLoad::TOO_MANY;
             }
-
-            // loop through every byte of the pattern data to find a match
-            // skipping over any bytes if the value is REGEX_SKIP
-            u32 count{};
-            while (count < p.byte_pattern.size) {
-                if (p.byte_pattern.data[count] != data[i + count] && p.byte_pattern.data[count] != REGEX_SKIP) {
-                    break;
-                }
-                count++;
+            if (title.name[sizeof(title.name) - 1]) {
+                return PatternDbLoad::INVALID;
             }
 
-            // if we have found a matching pattern
-            if (count == p.byte_pattern.size) {
-                // fetch the instruction
-                u32 inst{};
-                const auto inst_offset = i + p.inst_offset;
-                std::memcpy(&inst, data.data() + inst_offset, sizeof(inst));
-
-                // check if the instruction is the one that we want
-                if (p.cond(inst)) {
-                    const auto [patch_data, patch_size] = p.patch(inst);
-                    const auto patch_offset = addr + inst_offset + p.patch_offset;
-
-                    // todo: log failed writes, although this should in theory never fail
-                    if (R_FAILED(svcWriteDebugProcessMemory(handle, &patch_data, patch_offset, patch_size))) {
-                        p.result = PatchedResult::FAILED_WRITE;
-                    } else {
-                        p.result = PatchedResult::PATCHED_SYSPATCH;
-                    }
-                    // move onto next pattern
-                    break;
-                } else if (p.applied(inst)) {
-                    // patch already applied by sigpatches
-                    p.result = PatchedResult::PATCHED_FILE;
-                    break;
-                }
-            }
+            db_patches[title_count++] = { title.name, title.title_id, std::span<const Patterns>{db_patterns + n, 0}, title.min_fw, title.max_fw };
+            last_title = src.title;
+        }
+
+        auto& dst = db_patterns[n];
+        dst = {};
+        dst.patch_name = src.name;
+        // points into the buffer, which is kept
+        dst.byte_pattern = PatternData{ data + src.data_offset, pattern_db_info(src) };
+        dst.inst_offset = src.inst_offset;
+        dst.patch_offset = src.patch_offset;
+        dst.cond = src.cond;
+        dst.patch = src.patch;
+        dst.applied = src.applied;
+        dst.min_fw_ver = src.min_fw;
+        dst.max_fw_ver = src.max_fw;
+        dst.min_ams_ver = src.min_ams;
+        dst.max_ams_ver = src.max_ams;
+        dst.expected_count = src.expected_count ? src.expected_count : 1;
+        if (src.parent < header->pattern_count) {
+            dst.parent = patterns[src.parent].name;
+            dst.window = src.window;
         }
+        if (src.module_offset != PATTERN_DB_NO_MODULE) {
+            dst.module = (const char*)data + src.module_offset;
+        }
+
+        auto& entry = db_patches[title_count - 1];
+        entry.patterns = std::span{entry.patterns.data(), entry.patterns.size() + 1};
     }
+
+    PATCHES = std::span{db_patches, title_count};
+    scope.keep(buffer + size);
+    return PatternDbLoad::LOADED;
 }
 
-auto apply_patch(PatchEntry& patch) -> bool {
-    Handle handle{};
-    DebugEventInfo event_info{};
+// writes the whole file with a single write
+auto write_file(const char* path, const void* data, u64 size) -> bool {
+    Result rc{};
+    FsFile file{};
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
 
-    u64 pids[0x50]{};
-    s32 process_count{};
-    static u8 buffer[READ_BUFFER_SIZE];
+    if (!fs) {
+        return false;
+    }
+
+    strcpy(path_buf, path);
+    fsFsDeleteFile(fs, path_buf);
+    if (R_FAILED(rc = fsFsCreateFile(fs, path_buf, size, 0))) {
+        return false;
+    }
+    if (R_FAILED(rc = fsFsOpenFile(fs, path_buf, FsOpenMode_Write, &file))) {
+        return false;
+    }
+
+    rc = fsFileWrite(&file, 0, data, size, FsWriteOption_None);
+    fsFileClose(&file);
+    return R_SUCCEEDED(rc);
+}
 
-    // skip if version isn't valid
-    if (VERSION_SKIP &&
-        ((patch.min_fw_ver && patch.min_fw_ver > FW_VERSION) ||
-        (patch.max_fw_ver && patch.max_fw_ver < FW_VERSION))) {
-        for (auto& p : patch.patterns) {
-            p.result = PatchedResult::SKIPPED;
+// writes this boot's record over the oldest one in the history, buffer is HISTORY_FILE_SIZE.
+// the file is only (re)created if it's missing or from another version.
+auto append_history(HistoryRecord& record, u8* buffer) -> bool {
+    Result rc{};
+    FsFile file{};
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
+    u64 size{};
+
+    if (!fs) {
+        return false;
+    }
+
+    // the posix time, from the fs timestamp of the timing file which was just written
+    FsTimeStampRaw timestamp{};
+    strcpy(path_buf, TIMING_PATH);
+    if (R_SUCCEEDED(fsFsGetFileTimeStampRaw(fs, path_buf, &timestamp)) && timestamp.is_valid) {
+        record.timestamp = timestamp.modified;
+    }
+
+    auto header = (HistoryHeader*)buffer;
+    strcpy(path_buf, HISTORY_PATH);
+    if (!read_file(HISTORY_PATH, buffer, HISTORY_FILE_SIZE, &size) || !history_validate(buffer, size)) {
+        std::memset(buffer, 0, HISTORY_FILE_SIZE);
+        header->magic = HISTORY_MAGIC;
+        header->version = HISTORY_VERSION;
+        header->header_size = sizeof(HistoryHeader);
+        header->record_size = sizeof(HistoryRecord);
+        header->record_count = HISTORY_RECORD_COUNT;
+        if (!write_file(HISTORY_PATH, buffer, HISTORY_FILE_SIZE)) {
+            return false;
         }
-        return true;
     }
 
-    if (R_FAILED(svcGetProcessList(&process_count, pids, 0x50))) {
+    record.sequence = history_last_sequence(header) + 1;
+    if (R_FAILED(rc = fsFsOpenFile(fs, path_buf, FsOpenMode_Write, &file))) {
         return false;
     }
 
-    for (s32 i = 0; i < (process_count - 1); i++) {
-        if (R_SUCCEEDED(svcDebugActiveProcess(&handle, pids[i])) &&
-            R_SUCCEEDED(svcGetDebugEvent(&event_info, handle)) &&
-            patch.title_id == event_info.title_id) {
-            MemoryInfo mem_info{};
-            u64 addr{};
-            u32 page_info{};
-
-            for (;;) {
-                if (R_FAILED(svcQueryDebugProcessMemory(&mem_info, &page_info, handle, addr))) {
-                    break;
-                }
-                addr = mem_info.addr + mem_info.size;
+    rc = fsFileWrite(&file, history_record_offset(header, record.sequence), &record, sizeof(record), FsWriteOption_None);
+    fsFileClose(&file);
+    return R_SUCCEEDED(rc);
+}
 
-                // if addr=0 then we hit the reserved memory section
-                if (!addr) {
-                    break;
-                }
-                // skip memory that we don't want
-                if (!mem_info.size || (mem_info.perm & Perm_Rx) != Perm_Rx || ((mem_info.type & 0xFF) != MemType_CodeStatic)) {
-                    continue;
-                }
+// copies s into out, truncating if needed
+template<u64 N>
+void str_copy(char (&out)[N], const char* s) {
+    std::strncpy(out, s, N - 1);
+    out[N - 1] = '\0';
+}
 
-                // todo: the byte pattern can in between 2 READ_BUFFER_SIZE boundries!
-                for (u64 sz = 0; sz < mem_info.size; sz += READ_BUFFER_SIZE) {
-                    const auto actual_size = std::min(READ_BUFFER_SIZE, mem_info.size);
-                    if (R_FAILED(svcReadDebugProcessMemory(buffer, handle, mem_info.addr + sz, actual_size))) {
-                        // todo: log failed reads!
-                        break;
-                    } else {
-                        patcher(handle, std::span{buffer, actual_size}, mem_info.addr + sz, patch.patterns);
-                    }
-                }
+// starts capturing the svcs of the scan, until trace_end()
+void trace_begin(bool pattern_db) {
+    char path_buf[FS_MAX_PATH]{};
+    auto fs = ini_fs_get();
+
+    if (!fs) {
+        return;
+    }
+
+    strcpy(path_buf, TRACE_PATH);
+    fsFsDeleteFile(fs, path_buf);
+    if (R_FAILED(fsFsCreateFile(fs, path_buf, 0, 0)) ||
+        R_FAILED(fsFsOpenFile(fs, path_buf, FsOpenMode_Write | FsOpenMode_Append, &TRACE.file))) {
+        return;
+    }
+
+    TraceHeader header{};
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(TraceHeader);
+    header.event_size = sizeof(TraceEvent);
+    header.match_all = MATCH_ALL;
+    header.pattern_db = pattern_db;
+    header.fw_version = FW_VERSION;
+    header.ams_version = AMS_VERSION;
+    header.read_buffer_size = READ_BUFFER_SIZE;
+    header.tick_frequency = armGetSystemTickFreq();
+    str_copy(header.syspatch_version, VERSION_WITH_HASH);
+
+    TRACE.open = true;
+    TRACE.active = true;
+    TRACE.append(&header, sizeof(header));
+}
+
+// returns true if the whole scan was captured
+auto trace_end() -> bool {
+    const auto captured = TRACE.open && TRACE.active;
+    if (TRACE.open) {
+        fsFileClose(&TRACE.file);
+    }
+    TRACE.open = TRACE.active = false;
+    return captured;
+}
+
+// fills buffer with the results file, returns the size of the file.
+// entries that don't fit in the buffer are dropped.
+auto build_results(std::span<u8> buffer, bool emummc, bool enable_patching, u64 patch_time_ns) -> u64 {
+    auto header = (ResultsHeader*)buffer.data();
+    auto entries = (ResultsEntry*)(header + 1);
+    const auto max_entries = (buffer.size() - sizeof(ResultsHeader)) / sizeof(ResultsEntry);
+
+    std::memset(header, 0, sizeof(*header));
+    header->magic = RESULTS_MAGIC;
+    header->version = RESULTS_VERSION;
+    header->header_size = sizeof(ResultsHeader);
+    header->entry_size = sizeof(ResultsEntry);
+    header->fw_version = FW_VERSION;
+    header->ams_hash = AMS_HASH;
+    header->patch_time_ns = patch_time_ns;
+    header->ams_version = AMS_VERSION;
+    header->ams_target_version = AMS_TARGET_VERSION;
+    header->ams_keygen = AMS_KEYGEN;
+    header->is_emummc = emummc;
+    header->patching_enabled = enable_patching;
+    str_copy(header->syspatch_version, VERSION_WITH_HASH);
+
+    for (u32 t = 0; t < PATCHES.size(); t++) {
+        const auto& patch = PATCHES[t];
+        for (u16 i = 0; i < patch.patterns.size() && header->entry_count < max_entries; i++) {
+            const auto& p = patch.patterns[i];
+            const auto& r = TITLES[t].results[i];
+            auto& entry = entries[header->entry_count++];
+
+            std::memset(&entry, 0, sizeof(entry));
+            entry.title_id = patch.title_id;
+            entry.address = r.addr;
+            if (r.ticks) {
+                entry.time_us = (armTicksToNs(r.ticks) - armTicksToNs(PATCH_TICKS_START)) / 1000ULL;
             }
-            svcCloseHandle(handle);
-            return true;
-        } else if (handle) {
-            svcCloseHandle(handle);
-            handle = 0;
+            entry.pattern_id = i;
+            entry.result = r.result;
+            entry.match_count = r.match_count;
+            str_copy(entry.title_name, patch.name);
+            str_copy(entry.pattern_name, p.patch_name);
+            entry.process_id = TITLES[t].process_id;
+            entry.code_addr = TITLES[t].code_addr;
         }
     }
 
-    return false;
+    return sizeof(ResultsHeader) + sizeof(ResultsEntry) * header->entry_count;
 }
 
-// creates a directory, non-recursive!
-auto create_dir(const char* path) -> bool {
-    Result rc{};
-    FsFileSystem fs{};
-    char path_buf[FS_MAX_PATH]{};
+// on a rescan, restores what was patched by the previous run from its results file
+auto restore_results() -> bool {
+    ArenaScope scope{ARENA};
+    const auto buffer = (u8*)ARENA.alloc<u64>(RESULTS_MAX_SIZE / sizeof(u64));
+    u64 size{};
+    if (!read_file(RESULTS_PATH, buffer, RESULTS_MAX_SIZE, &size)) {
+        return false;
+    }
 
-    if (R_FAILED(fsOpenSdCardFileSystem(&fs))) {
+    const auto header = results_validate(buffer, size);
+    if (!header || header->fw_version != FW_VERSION || header->ams_hash != AMS_HASH) {
         return false;
     }
 
-    strcpy(path_buf, path);
-    rc = fsFsCreateDirectory(&fs, path_buf);
-    fsFsClose(&fs);
-    return R_SUCCEEDED(rc);
-}
+    for (u32 i = 0; i < header->entry_count; i++) {
+        const auto entry = results_entry(header, i);
+        if (entry->result != PatchedResult::PATCHED_FILE && entry->result != PatchedResult::PATCHED_SYSPATCH) {
+            continue;
+        }
 
-// same as ini_get but writes out the default value instead
-auto ini_load_or_write_default(const char* section, const char* key, long _default, const char* path) -> long {
-    if (!ini_haskey(section, key, path)) {
-        ini_putl(section, key, _default, path);
-        return _default;
-    } else {
-        return ini_getl(section, key, _default, path);
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            const auto& patch = PATCHES[t];
+            if (patch.title_id != entry->title_id) {
+                continue;
+            }
+            for (u32 n = 0; n < patch.patterns.size(); n++) {
+                if (!std::strncmp(patch.patterns[n].patch_name, entry->pattern_name, sizeof(entry->pattern_name))) {
+                    auto& r = TITLES[t].results[n];
+                    r.result = entry->result;
+                    r.addr = entry->address;
+                    r.cached = true;
+                    TITLES[t].cached_process_id = entry->process_id;
+                    TITLES[t].cached_code_addr = entry->code_addr;
+                }
+            }
+        }
     }
+
+    return true;
 }
 
-auto patch_result_to_str(PatchedResult result) -> const char* {
-    switch (result) {
-        case PatchedResult::NOT_FOUND: return "Unpatched";
-        case PatchedResult::SKIPPED: return "Skipped";
-        case PatchedResult::PATCHED_FILE: return "Patched (file)";
-        case PatchedResult::PATCHED_SYSPATCH: return "Patched (sys-patch)";
-        case PatchedResult::FAILED_WRITE: return "Failed (svcWriteDebugProcessMemory)";
-    }
+// crc32c of data, with the armv8 crc instructions
+auto crc32c(const void* data, u64 size) -> u32 {
+    auto p = (const u8*)data;
+    u32 crc = ~0U;
 
-    std::unreachable();
+    for (; size >= sizeof(u64); size -= sizeof(u64), p += sizeof(u64)) {
+        u64 v;
+        std::memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+    for (; size; size--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return ~crc;
 }
 
 void num_2_str(char*& s, u16 num) {
@@ -500,17 +999,66 @@ void keygen_to_str(char* s, u8 keygen) {
 } // namespace
 
 int main(int argc, char* argv[]) {
-    constexpr auto ini_path = "/config/sys-patch/config.ini";
-    constexpr auto log_path = "/config/sys-patch/log.ini";
-
     create_dir("/config/");
     create_dir("/config/sys-patch/");
-    ini_remove(log_path);
 
-    const auto patch_sysmmc = ini_load_or_write_default("options", "patch_sysmmc", 1, ini_path);
-    const auto patch_emummc = ini_load_or_write_default("options", "patch_emummc", 1, ini_path);
-    const auto enable_logging = ini_load_or_write_default("options", "enable_logging", 1, ini_path);
-    VERSION_SKIP = ini_load_or_write_default("options", "version_skip", 1, ini_path);
+    // the overlay creates this before launching the sysmod again, to retry what wasn't patched
+    const auto rescan = ini_remove(RESCAN_PATH);
+    // created to capture the svcs of this boot's scan, see trace.hpp.
+    // only removed once the trace is written, so a boot that doesn't scan doesn't use it up
+    s64 capture_size{};
+    const auto capture = get_file_size(TRACE_REQUEST_PATH, &capture_size);
+    // the overlay creates this to benchmark the scan once, benchmark_runs does on every boot
+    const auto benchmark = ini_remove(BENCHMARK_PATH);
+
+    // read the config once, then write out any options that were missing
+    auto step_start = armGetSystemTick();
+    Config config{};
+    const auto missing = config_load(config);
+    {
+        ArenaScope scope{ARENA};
+        config_write(config, missing, ARENA.alloc<char>(INI_BUFFER_SIZE), INI_BUFFER_SIZE);
+    }
+    INIT.config = armGetSystemTick() - step_start;
+
+    const auto patch_sysmmc = config.patch_sysmmc;
+    const auto patch_emummc = config.patch_emummc;
+    const auto enable_logging = config.enable_logging;
+    VERSION_SKIP = config.version_skip;
+    MATCH_ALL = config.match_all;
+    TITLE_BUDGET_TICKS = armNsToTicks(config.title_budget_ms * 1000000ULL);
+    SCAN_BUDGET_TICKS = armNsToTicks(config.scan_budget_ms * 1000000ULL);
+    const auto benchmark_runs = config.benchmark_runs ? config.benchmark_runs : benchmark ? BENCHMARK_DEFAULT_RUNS : 0;
+
+    // the log, the rescan, a capture and version skip need the fw version. without them,
+    // it's only needed if a pattern's instruction check depends on it.
+    if (VERSION_SKIP || enable_logging || rescan || capture) {
+        load_fw_version();
+    }
+
+    step_start = armGetSystemTick();
+    const auto pattern_db_load = load_pattern_db();
+    const auto pattern_db = pattern_db_load == PatternDbLoad::LOADED;
+    titles_init();
+    INIT.pattern_db = armGetSystemTick() - step_start;
+
+    if (patches_use_cond(CondId::MOV2)) {
+        load_fw_version();
+    }
+    inst_init(FW_VERSION);
+
+    // the ams version is only logged, unless a pattern is limited to one or it's a rescan
+    // (the results are only restored if ams is the same)
+    if (enable_logging || rescan || (VERSION_SKIP && patches_use_ams_version())) {
+        load_ams_version();
+    }
+
+    // every service that's needed has been started
+    smExit();
+
+    if (rescan) {
+        restore_results();
+    }
     const auto emummc = is_emummc();
     bool enable_patching = true;
 
@@ -524,12 +1072,22 @@ int main(int argc, char* argv[]) {
         enable_patching = false;
     }
 
+    // before the real scan, so that it isn't in its times (though it's now warm)
+    if (enable_patching && benchmark_runs) {
+        run_benchmark(benchmark_runs);
+    }
+
     // speedtest
-    const auto ticks_start = armGetSystemTick();
+    PATCH_TICKS_START = armGetSystemTick();
+    const auto ticks_start = PATCH_TICKS_START;
 
     if (enable_patching) {
-        for (auto& patch : patches) {
-            apply_patch(patch);
+        if (capture) {
+            trace_begin(pattern_db);
+        }
+        apply_patches(PATCHES);
+        if (trace_end()) {
+            ini_remove(TRACE_REQUEST_PATH);
         }
     }
 
@@ -537,12 +1095,21 @@ int main(int argc, char* argv[]) {
     const auto diff_ns = armTicksToNs(ticks_end) - armTicksToNs(ticks_start);
 
     if (enable_logging) {
-        for (auto& patch : patches) {
-            for (auto& p : patch.patterns) {
+        // the log and then the results are assembled in here and written in one go
+        ArenaScope scope{ARENA};
+        const auto ini_buffer = (char*)ARENA.alloc<u64>(LOG_BUFFER_SIZE / sizeof(u64));
+        const auto file_buffer = (u8*)ARENA.alloc<u64>(FILE_BUFFER_SIZE / sizeof(u64));
+        INI_BATCH log{};
+        ini_batch_begin(&log, ini_buffer, LOG_BUFFER_SIZE, true, LOG_PATH);
+
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            const auto& patch = PATCHES[t];
+            for (u32 i = 0; i < patch.patterns.size(); i++) {
+                auto& r = TITLES[t].results[i];
                 if (!enable_patching) {
-                    p.result = PatchedResult::SKIPPED;
+                    r.result = PatchedResult::SKIPPED;
                 }
-                ini_puts(patch.name, p.patch_name, patch_result_to_str(p.result), log_path);
+                ini_batch_puts(&log, patch.name, patch.patterns[i].patch_name, patch_result_to_str(r.result));
             }
         }
 
@@ -569,17 +1136,177 @@ int main(int argc, char* argv[]) {
         // defined in the Makefile
         #define DATE (DATE_DAY "." DATE_MONTH "." DATE_YEAR " " DATE_HOUR ":" DATE_MIN ":" DATE_SEC)
 
-        ini_puts("stats", "version", VERSION_WITH_HASH, log_path);
-        ini_puts("stats", "build_date", DATE, log_path);
-        ini_puts("stats", "fw_version", fw_version, log_path);
-        ini_puts("stats", "ams_version", ams_version, log_path);
-        ini_puts("stats", "ams_target_version", ams_target_version, log_path);
-        ini_puts("stats", "ams_keygen", ams_keygen, log_path);
-        ini_puts("stats", "ams_hash", ams_hash, log_path);
-        ini_putl("stats", "is_emummc", emummc, log_path);
-        ini_putl("stats", "heap_size", INNER_HEAP_SIZE, log_path);
-        ini_putl("stats", "buffer_size", READ_BUFFER_SIZE, log_path);
-        ini_puts("stats", "patch_time", patch_time, log_path);
+        ini_batch_puts(&log, "stats", "version", VERSION_WITH_HASH);
+        ini_batch_puts(&log, "stats", "build_date", DATE);
+        ini_batch_puts(&log, "stats", "fw_version", fw_version);
+        ini_batch_puts(&log, "stats", "ams_version", ams_version);
+        ini_batch_puts(&log, "stats", "ams_target_version", ams_target_version);
+        ini_batch_puts(&log, "stats", "ams_keygen", ams_keygen);
+        ini_batch_puts(&log, "stats", "ams_hash", ams_hash);
+        ini_batch_putl(&log, "stats", "is_emummc", emummc);
+        ini_batch_putl(&log, "stats", "heap_size", INNER_HEAP_SIZE);
+        ini_batch_putl(&log, "stats", "buffer_size", READ_BUFFER_SIZE);
+        ini_batch_putl(&log, "stats", "arena_size", ARENA_SIZE);
+        ini_batch_putl(&log, "stats", "arena_peak", ARENA.peak);
+        ini_batch_puts(&log, "stats", "patterns", pattern_db ? "database" : "built-in");
+        ini_batch_puts(&log, "stats", "pattern_db", PATTERN_DB_LOAD_NAMES[(u8)pattern_db_load]);
+
+        // what scanning each title cost, titles that weren't scanned are left out
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            const auto& patch = PATCHES[t];
+            const auto& stats = TITLES[t].stats;
+            if (!stats.found) {
+                continue;
+            }
+
+            char key[32]{};
+            str_copy(key, patch.name);
+            const auto key_len = std::strlen(key);
+            const auto put_stat = [&](const char* name, long value) {
+                std::strncpy(key + key_len, name, sizeof(key) - key_len - 1);
+                ini_batch_putl(&log, "scan", key, value);
+            };
+            put_stat("_regions", stats.regions);
+            put_stat("_reads", stats.reads);
+            put_stat("_bytes", stats.bytes_read);
+            if (stats.modules) {
+                put_stat("_modules", stats.modules);
+            }
+        }
+
+        // the log only has what stays the same from boot to boot, so it's only
+        // written if its fingerprint differs from the one in the last log.
+        // if it can't be written, the last one is removed so that it isn't taken for this boot's.
+        char fingerprint[9]{};
+        char last_fingerprint[9]{};
+        hash_to_str(fingerprint, crc32c(ini_buffer, log.Length));
+        ini_gets("stats", "fingerprint", "", last_fingerprint, sizeof(last_fingerprint), LOG_PATH);
+        if (log.Error) {
+            ini_remove(LOG_PATH);
+        } else if (std::strcmp(fingerprint, last_fingerprint)) {
+            if (!ini_batch_puts(&log, "stats", "fingerprint", fingerprint) || !ini_batch_commit(&log)) {
+                ini_remove(LOG_PATH);
+            }
+        }
+
+        // what changes every boot is written to its own (small) file
+        INI_BATCH timing{};
+        ini_batch_begin(&timing, ini_buffer, LOG_BUFFER_SIZE, true, TIMING_PATH);
+        ini_batch_puts(&timing, "timing", "patch_time", patch_time);
+        ini_batch_putl(&timing, "timing", "rescan", rescan);
+
+        const auto put_time = [&](const char* key, u64 ticks) {
+            ini_batch_putl(&timing, "timing", key, armTicksToNs(ticks) / 1000ULL);
+        };
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            if (TITLES[t].stats.found) {
+                char key[32]{};
+                str_copy(key, PATCHES[t].name);
+                std::strncat(key, "_scan_us", sizeof(key) - std::strlen(key) - 1);
+                put_time(key, TITLES[t].stats.ticks);
+            }
+        }
+
+        // the startup steps, and how long it took to get to patching
+        u64 first_patch_ticks{};
+        for (const auto& r : RESULTS) {
+            if (r.result == PatchedResult::PATCHED_SYSPATCH && (!first_patch_ticks || r.ticks < first_patch_ticks)) {
+                first_patch_ticks = r.ticks;
+            }
+        }
+        put_time("sm_us", INIT.sm);
+        put_time("fs_us", INIT.fs);
+        put_time("setsys_us", INIT.setsys);
+        put_time("spl_us", INIT.spl);
+        put_time("config_us", INIT.config);
+        put_time("pattern_db_us", INIT.pattern_db);
+        put_time("start_to_scan_us", PATCH_TICKS_START - INIT.start);
+        if (first_patch_ticks) {
+            put_time("start_to_first_patch_us", first_patch_ticks - INIT.start);
+        }
+
+        if (BENCH.runs) {
+            ini_batch_putl(&timing, "benchmark", "runs", BENCH.runs);
+            const auto put_bench = [&](const char* name, const BenchTime& time) {
+                const auto put = [&](const char* suffix, u64 ticks) {
+                    char key[32]{};
+                    str_copy(key, name);
+                    std::strncat(key, suffix, sizeof(key) - std::strlen(key) - 1);
+                    ini_batch_putl(&timing, "benchmark", key, armTicksToNs(ticks) / 1000ULL);
+                };
+                put("_min_us", time.min);
+                put("_median_us", time.median);
+                put("_max_us", time.max);
+            };
+            put_bench("find", BENCH.find);
+            put_bench("total", BENCH.total);
+            for (u32 t = 0; t < PATCHES.size(); t++) {
+                if (!BENCH.found[t]) {
+                    continue;
+                }
+                put_bench(PATCHES[t].name, BENCH.titles[t]);
+
+                // bytes per us is MB/s
+                char key[32]{};
+                str_copy(key, PATCHES[t].name);
+                std::strncat(key, "_mb_s", sizeof(key) - std::strlen(key) - 1);
+                const auto median_us = armTicksToNs(BENCH.titles[t].median) / 1000ULL;
+                ini_batch_putl(&timing, "benchmark", key, median_us ? BENCH.bytes_read[t] / median_us : 0);
+            }
+        }
+        if (!ini_batch_commit(&timing)) {
+            ini_remove(TIMING_PATH);
+        }
+
+        // the addresses change every boot (and a rescan relies on them), so unlike the log this is
+        // written on every boot that logs. with logging off there's none, and a rescan searches for everything.
+        const auto results_size = build_results(std::span{file_buffer, FILE_BUFFER_SIZE}, emummc, enable_patching, diff_ns);
+        write_file(RESULTS_PATH, file_buffer, results_size);
+
+        // written last, as its timestamp is taken from timing.ini
+        HistoryRecord record{};
+        const auto to_us = [](u64 ticks) -> u32 {
+            return armTicksToNs(ticks) / 1000ULL;
+        };
+        record.ams_hash = AMS_HASH;
+        record.fw_version = FW_VERSION;
+        record.ams_version = AMS_VERSION;
+        record.patch_time_us = diff_ns / 1000ULL;
+        record.start_to_scan_us = to_us(PATCH_TICKS_START - INIT.start);
+        record.start_to_first_patch_us = first_patch_ticks ? to_us(first_patch_ticks - INIT.start) : 0;
+        record.init_us[HistoryInit_Sm] = to_us(INIT.sm);
+        record.init_us[HistoryInit_Fs] = to_us(INIT.fs);
+        record.init_us[HistoryInit_Setsys] = to_us(INIT.setsys);
+        record.init_us[HistoryInit_Spl] = to_us(INIT.spl);
+        record.init_us[HistoryInit_Config] = to_us(INIT.config);
+        record.init_us[HistoryInit_PatternDb] = to_us(INIT.pattern_db);
+        record.flags = (emummc ? HistoryFlag_Emummc : 0) | (rescan ? HistoryFlag_Rescan : 0) |
+            (pattern_db ? HistoryFlag_PatternDb : 0) | (MATCH_ALL ? HistoryFlag_MatchAll : 0) |
+            (BENCH.runs ? HistoryFlag_Benchmark : 0);
+        str_copy(record.syspatch_version, VERSION_WITH_HASH);
+
+        for (u32 t = 0; t < PATCHES.size(); t++) {
+            const auto& stats = TITLES[t].stats;
+            record.bytes_read += stats.bytes_read;
+            record.reads += stats.reads;
+            record.queries += stats.queries;
+            record.regions += stats.regions;
+            record.flags |= stats.timed_out ? HistoryFlag_TimedOut : 0;
+
+            for (const auto& r : TITLES[t].results) {
+                const auto bit = 1ULL << (record.pattern_count++ % 64);
+                if (r.result == PatchedResult::PATCHED_FILE || r.result == PatchedResult::PATCHED_SYSPATCH) {
+                    record.patched |= bit;
+                } else if (r.result != PatchedResult::SKIPPED) {
+                    record.unpatched |= bit;
+                }
+            }
+        }
+        append_history(record, file_buffer);
+    } else {
+        ini_remove(LOG_PATH);
+        ini_remove(TIMING_PATH);
+        ini_remove(RESULTS_PATH);
     }
 
     // note: sysmod exits here.
@@ -598,63 +1325,43 @@ u32 __nx_fs_num_sessions = 1;
 
 // Newlib heap configuration function (makes malloc/free work).
 void __libnx_initheap(void) {
-    static char inner_heap[INNER_HEAP_SIZE];
     extern char* fake_heap_start;
     extern char* fake_heap_end;
 
+    #if defined SYS_PATCH_STATIC_ARENA
+    // no heap, malloc fails instead of using memory that isn't accounted for
+    fake_heap_start = nullptr;
+    fake_heap_end   = nullptr;
+    #else
+    static char inner_heap[INNER_HEAP_SIZE];
+
     // Configure the newlib heap.
     fake_heap_start = inner_heap;
     fake_heap_end   = inner_heap + sizeof(inner_heap);
+    #endif
 }
 
 // Service initialization.
+// only fs is needed by everything, set:sys and spl are started by main() if needed.
+// the processes are attached to with svcs, so no pm service is needed.
 void __appInit(void) {
     Result rc{};
+    INIT.start = armGetSystemTick();
 
-    // Open a service manager session.
+    // Open a service manager session, main() closes it.
     if (R_FAILED(rc = smInitialize()))
         fatalThrow(rc);
+    INIT.sm = armGetSystemTick() - INIT.start;
 
-    // Retrieve the current version of Horizon OS.
-    if (R_SUCCEEDED(rc = setsysInitialize())) {
-        SetSysFirmwareVersion fw{};
-        if (R_SUCCEEDED(rc = setsysGetFirmwareVersion(&fw))) {
-            FW_VERSION = MAKEHOSVERSION(fw.major, fw.minor, fw.micro);
-            hosversionSet(FW_VERSION);
-        }
-        setsysExit();
-    }
-
-    // get ams version
-    if (R_SUCCEEDED(rc = splInitialize())) {
-        u64 v{};
-        u64 hash{};
-        if (R_SUCCEEDED(rc = splGetConfig((SplConfigItem)65000, &v))) {
-            AMS_VERSION = (v >> 40) & 0xFFFFFF;
-            AMS_KEYGEN = (v >> 32) & 0xFF;
-            AMS_TARGET_VERSION = v & 0xFFFFFF;
-        }
-        if (R_SUCCEEDED(rc = splGetConfig((SplConfigItem)65003, &hash))) {
-            AMS_HASH = hash;
-        }
-
-        splExit();
-    }
-
+    const auto fs_start = armGetSystemTick();
     if (R_FAILED(rc = fsInitialize()))
         fatalThrow(rc);
-
-    // Add other services you want to use here.
-    if (R_FAILED(rc = pmdmntInitialize()))
-        fatalThrow(rc);
-
-    // Close the service manager session.
-    smExit();
+    INIT.fs = armGetSystemTick() - fs_start;
 }
 
 // Service deinitialization.
 void __appExit(void) {
-    pmdmntExit();
+    ini_fs_exit();
     fsExit();
 }
 
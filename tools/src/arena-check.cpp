@@ -0,0 +1,362 @@
+// checks the sysmod's memory budget (see common/arena.hpp) on a pc: every phase is run against
+// an Arena of ARENA_SIZE as the sysmod runs it, and every title of the built-in patterns and of
+// the pattern database is scanned (in both modes) with the heap counted, which must stay at 0.
+// the log is filled as it would be at MAX_TITLES titles and PATTERN_DB_MAX_PATTERNS patterns.
+// usage: arena-check <patterns.bin>
+//  the process scanned is made up: random code with each pattern (and the instruction it
+//  points at) planted in it, and a loaded module for every module a pattern names. a child
+//  is planted 0x40 bytes after the pattern before it, so one with a smaller window isn't found.
+//  make -C tools check also runs it on tools/check-patterns.txt, which has what patterns.txt doesn't use.
+//  exits with 1 if the arena or the log overflowed, or the scan allocated.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "arena.hpp"
+#include "patches.hpp"
+#include "host_scan.hpp"
+
+// the heap is counted by wrapping glibc's allocator, which operator new also goes through
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+}
+
+namespace {
+
+bool COUNTING{}; // only the scan is counted, setting up the process allocates
+u64 HEAP_ALLOCS{};
+
+} // namespace
+
+extern "C" {
+
+void* malloc(size_t size) {
+    HEAP_ALLOCS += COUNTING;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    HEAP_ALLOCS += COUNTING;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    HEAP_ALLOCS += COUNTING;
+    return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+    HEAP_ALLOCS += COUNTING;
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void** out, size_t align, size_t size) {
+    HEAP_ALLOCS += COUNTING;
+    *out = __libc_memalign(align, size);
+    return *out ? 0 : 12; // ENOMEM
+}
+
+} // extern "C"
+
+namespace {
+
+constexpr u64 CODE_ADDR = 0x8000000;
+constexpr u64 CODE_SIZE = 0x80000;
+constexpr u64 MODULE_SIZE = 0x20000;
+constexpr u64 DATA_SIZE = 0x10000;
+
+// a process laid out as the debug svcs would report it: code, then data, then each module
+struct ProcessTarget : ImageTarget {
+    std::vector<ScanRegion> regions; // sorted, without gaps
+
+    auto query(u64 addr, ScanRegion& out) -> bool {
+        for (const auto& r : regions) {
+            if (addr >= r.addr && addr - r.addr < r.size) {
+                out = r;
+                return true;
+            }
+        }
+        // the end of the address space, which the scan stops at
+        out = { addr, 0 - addr, ScanCode_None };
+        return true;
+    }
+};
+
+// writes the pattern (and the instruction it points at, if it's outside of it) at addr
+void plant(ProcessTarget& target, const Patterns& p, u64 addr, std::mt19937& rng) {
+    const auto& bp = p.byte_pattern;
+    auto data = target.image.data() + (addr - target.base);
+    for (u32 i = 0; i < bp.size; i++) {
+        data[i] = (rng() & ~bp.mask[i]) | bp.value[i];
+    }
+    for (u32 n = 0; n < bp.alt_count; n++) {
+        const auto alt = bp.alts + n * PATTERN_ALT_SIZE;
+        data[alt[0]] = alt[2];
+    }
+
+    const s64 inst_offset = p.inst_offset;
+    if (inst_offset + 4 <= 0 || inst_offset >= bp.size) {
+        const auto inst = INST_CONDS[(u8)p.cond].value[0];
+        target.write(&inst, addr + inst_offset, sizeof(inst));
+    }
+}
+
+// the start of an nro mapped by ro, with its path at the start of rodata
+void make_module(ProcessTarget& target, u64 addr, const char* name) {
+    ScanNroStart start{};
+    start.magic = 0x304F524E; // "NRO0"
+    start.segments[1][0] = 0x1000;
+    start.segments[1][1] = sizeof(ScanModulePath);
+    std::snprintf((char*)start.build_id, sizeof(start.build_id), "%s", name);
+    target.write(&start, addr, sizeof(start));
+
+    ScanModulePath path{};
+    path.length = std::snprintf(path.path, sizeof(path.path), "D:/home/build/%s", name);
+    target.write(&path, addr + start.segments[1][0], sizeof(path));
+}
+
+// a process with every pattern of patterns planted in it, in the code or the module it names
+void make_process(ProcessTarget& target, std::vector<u8>& memory, std::span<const Patterns> patterns) {
+    std::vector<std::string> modules;
+    for (const auto& p : patterns) {
+        if (p.module && std::find(modules.begin(), modules.end(), p.module) == modules.end()) {
+            modules.emplace_back(p.module);
+        }
+    }
+
+    std::mt19937 rng{1};
+    memory.resize(CODE_SIZE + DATA_SIZE + MODULE_SIZE * modules.size());
+    for (auto& b : memory) {
+        b = rng();
+    }
+    target.image = memory;
+    target.base = CODE_ADDR;
+    target.regions = {
+        { 0, CODE_ADDR, ScanCode_None },
+        { CODE_ADDR, CODE_SIZE, ScanCode_Static },
+        { CODE_ADDR + CODE_SIZE, DATA_SIZE, ScanCode_None },
+    };
+    for (u32 m = 0; m < modules.size(); m++) {
+        const auto addr = CODE_ADDR + CODE_SIZE + DATA_SIZE + MODULE_SIZE * m;
+        target.regions.push_back({ addr, MODULE_SIZE, ScanCode_Module });
+        make_module(target, addr, modules[m].c_str());
+    }
+
+    // a child is planted just after the pattern before it (its parent in patterns.txt), inside its window
+    u64 code_at = CODE_ADDR;
+    std::vector<u64> module_at(modules.size(), 0x1000);
+    u64 last{};
+    for (const auto& p : patterns) {
+        u64 addr{};
+        if (p.parent && last) {
+            addr = last + 0x40;
+        } else if (p.module) {
+            const auto m = std::find(modules.begin(), modules.end(), p.module) - modules.begin();
+            module_at[m] += 0x1000;
+            addr = CODE_ADDR + CODE_SIZE + DATA_SIZE + MODULE_SIZE * m + module_at[m];
+        } else {
+            code_at += 0x1000;
+            addr = code_at;
+        }
+        if (addr + 0x1000 <= target.base + memory.size()) {
+            plant(target, p, addr, rng);
+        }
+        last = addr;
+    }
+}
+
+struct CheckTitle {
+    std::string name;
+    std::span<const Patterns> patterns;
+};
+
+// scans a title as apply_patches() does, inside a benchmark's allocations. returns false if
+// it allocated, or if it kept scanning in first match mode once nothing more could be found
+auto check_scan(Arena& arena, const CheckTitle& title, bool match_all) -> bool {
+    static PatternResult results[PATTERN_DB_MAX_PATTERNS];
+    ProcessTarget target;
+    std::vector<u8> memory;
+    make_process(target, memory, title.patterns);
+
+    ArenaScope benchmark{arena};
+    arena.alloc<PatternResult>(PATTERN_DB_MAX_PATTERNS);
+    arena.alloc<u64>(BENCHMARK_SAMPLE_COUNT);
+
+    ArenaScope scope{arena};
+    u8* read_buffer{};
+    auto& scanner = arena_alloc_scan(arena, &read_buffer);
+    std::fill(std::begin(results), std::end(results), PatternResult{});
+
+    const auto allocs = HEAP_ALLOCS;
+    COUNTING = true;
+    ScanStats stats{};
+    if (scanner_init(scanner, title.patterns, results, match_all)) {
+        scanner_scan_regions(scanner, target, stats, read_buffer, READ_BUFFER_SIZE, UINT64_MAX);
+    }
+    COUNTING = false;
+
+    // every pattern without a parent is planted, so once they've been found only children
+    // that weren't in their parent's windows are left, which can't be found any more
+    u32 patched{};
+    bool found_all{true};
+    for (u32 i = 0; i < title.patterns.size(); i++) {
+        patched += results[i].result == PatchedResult::PATCHED_SYSPATCH;
+        found_all &= title.patterns[i].parent || results[i].result != PatchedResult::NOT_FOUND;
+    }
+    std::printf("  %-12s %-9s %2u/%-2zu patched, %u regions, %u modules, %u reads, %llu bytes\n",
+        title.name.c_str(), match_all ? "match-all" : "first", patched, title.patterns.size(),
+        stats.regions, stats.modules, stats.reads, (unsigned long long)stats.bytes_read);
+
+    bool ok{true};
+    if (HEAP_ALLOCS != allocs) {
+        std::printf("  %s made %llu heap allocations\n", title.name.c_str(), (unsigned long long)(HEAP_ALLOCS - allocs));
+        ok = false;
+    }
+    if (!match_all && found_all && scanner.remaining) {
+        std::printf("  %s kept scanning for %u patterns that can't be found\n", title.name.c_str(), scanner.remaining);
+        ok = false;
+    }
+    return ok;
+}
+
+// fills log.ini and timing.ini as the sysmod does, with MAX_TITLES titles, PATTERN_DB_MAX_PATTERNS
+// patterns and the longest names and values, returns false if either overflows LOG_BUFFER_SIZE
+auto check_log(char* buffer) -> bool {
+    constexpr auto longest_result = "Failed (svcWriteDebugProcessMemory)";
+    constexpr auto longest_number = "-9223372036854775807";
+    constexpr auto fixed_keys = 16; // more than [stats] / [timing] have
+
+    const auto title_name = [](u32 t) {
+        char name[sizeof(PatternDbTitle::name)]{};
+        std::snprintf(name, sizeof(name), "title%02u", t);
+        return std::string{name};
+    };
+    const auto put_titles = [&](INI_BATCH* batch, const char* section, std::initializer_list<const char*> suffixes) {
+        for (u32 t = 0; t < MAX_TITLES; t++) {
+            for (const auto suffix : suffixes) {
+                ini_batch_puts(batch, section, (title_name(t) + suffix).c_str(), longest_number);
+            }
+        }
+    };
+    const auto put_fixed = [&](INI_BATCH* batch, const char* section) {
+        for (u32 k = 0; k < fixed_keys; k++) {
+            char key[24]{};
+            std::snprintf(key, sizeof(key), "start_to_first_patch%02u", k);
+            ini_batch_puts(batch, section, key, longest_number);
+        }
+    };
+
+    INI_BATCH log{};
+    ini_batch_begin(&log, buffer, LOG_BUFFER_SIZE, true, "log.ini");
+    for (u32 i = 0; i < PATTERN_DB_MAX_PATTERNS; i++) {
+        char name[sizeof(PatternDbPattern::name)]{};
+        std::snprintf(name, sizeof(name), "%0*u", (int)sizeof(name) - 1, i);
+        ini_batch_puts(&log, title_name(i % MAX_TITLES).c_str(), name, longest_result);
+    }
+    put_fixed(&log, "stats");
+    put_titles(&log, "scan", { "_regions", "_reads", "_bytes", "_modules" });
+    ini_batch_puts(&log, "stats", "fingerprint", "01234567");
+
+    INI_BATCH timing{};
+    ini_batch_begin(&timing, buffer, LOG_BUFFER_SIZE, true, "timing.ini");
+    put_fixed(&timing, "timing");
+    put_titles(&timing, "timing", { "_scan_us" });
+    for (const auto name : { "find", "total" }) {
+        for (const auto suffix : { "_min_us", "_median_us", "_max_us" }) {
+            ini_batch_puts(&timing, "benchmark", (std::string{name} + suffix).c_str(), longest_number);
+        }
+    }
+    put_titles(&timing, "benchmark", { "_min_us", "_median_us", "_max_us", "_mb_s" });
+
+    std::printf("log: %d and %d of %llu bytes at the limits\n", log.Length, timing.Length, (unsigned long long)LOG_BUFFER_SIZE);
+    return !log.Error && !timing.Error;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: arena-check <patterns.bin>\n");
+        return 1;
+    }
+
+    std::vector<u8> file;
+    std::vector<HostTitle> db_titles;
+    if (!host_read_file(argv[1], file) || !host_load_pattern_db(file, db_titles)) {
+        std::fprintf(stderr, "failed to load %s\n", argv[1]);
+        return 1;
+    }
+    if (file.size() > PATTERN_DB_MAX_SIZE) {
+        std::fprintf(stderr, "%s is %zu bytes, the arena holds %llu\n", argv[1], file.size(), (unsigned long long)PATTERN_DB_MAX_SIZE);
+        return 1;
+    }
+
+    alignas(0x10) static u8 arena_data[ARENA_SIZE];
+    Arena arena{arena_data, sizeof(arena_data)};
+    bool ok{true};
+
+    // kept until exit, as load_pattern_db() does
+    {
+        ArenaScope scope{arena};
+        const auto db = (u8*)arena.alloc<u64>((file.size() + sizeof(u64) - 1) / sizeof(u64));
+        std::memcpy(db, file.data(), file.size());
+        scope.keep(db + file.size());
+    }
+
+    // config
+    {
+        ArenaScope scope{arena};
+        arena.alloc<char>(INI_BUFFER_SIZE);
+    }
+
+    // restoring results
+    {
+        ArenaScope scope{arena};
+        arena.alloc<u64>(RESULTS_MAX_SIZE / sizeof(u64));
+    }
+
+    std::vector<CheckTitle> titles;
+    for (const auto& p : patches) {
+        titles.push_back({ std::string{"built-in "} + p.name, p.patterns });
+    }
+    for (const auto& t : db_titles) {
+        titles.push_back({ "db " + t.name, t.patterns });
+    }
+
+    std::printf("scanning:\n");
+    for (const auto& t : titles) {
+        if (t.patterns.size() > PATTERN_DB_MAX_PATTERNS) {
+            std::printf("  %s has %zu patterns, over %u\n", t.name.c_str(), t.patterns.size(), PATTERN_DB_MAX_PATTERNS);
+            ok = false;
+            continue;
+        }
+        for (const auto match_all : { false, true }) {
+            ok &= check_scan(arena, t, match_all);
+        }
+    }
+
+    // logging
+    {
+        ArenaScope scope{arena};
+        ok &= check_log((char*)arena.alloc<u64>(LOG_BUFFER_SIZE / sizeof(u64)));
+        arena.alloc<u64>(FILE_BUFFER_SIZE / sizeof(u64));
+    }
+
+    // alloc() aborts on overflow, so this is only reached if the arena was big enough
+    std::printf("arena: peak %llu of %llu bytes (pattern db %zu, heap %llu, %s)\n",
+        (unsigned long long)arena.peak, (unsigned long long)ARENA_SIZE, file.size(), (unsigned long long)INNER_HEAP_SIZE,
+        #if defined SYS_PATCH_STATIC_ARENA
+        "static arena"
+        #else
+        "default"
+        #endif
+    );
+    ok &= arena.peak <= ARENA_SIZE;
+    std::printf("%s\n", ok ? "ok" : "failed");
+    return ok ? 0 : 1;
+}
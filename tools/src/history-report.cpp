@@ -0,0 +1,185 @@
+// summarises the boot history written by the sysmod (see common/history.hpp).
+// usage: history-report [-threshold percent] <history.bin>
+//  prints every boot oldest first, then the times per sys-patch version and fw, then
+//  where the median patch time rose by more than threshold (default 25) percent, or
+//  patterns stopped being patched, from one version / fw to the next.
+//  exits with 2 if there were any regressions.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "history.hpp"
+
+namespace {
+
+// the boots with the same sys-patch version and fw, in the order they were first seen
+struct Group {
+    std::string version;
+    u32 fw_version;
+    std::vector<const HistoryRecord*> records;
+    u64 always_patched; // patched on every boot of the group
+};
+
+auto version_str(u32 ver) -> std::string {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%u.%u.%u", (ver >> 16) & 0xFF, (ver >> 8) & 0xFF, ver & 0xFF);
+    return buf;
+}
+
+auto date_str(u64 timestamp) -> std::string {
+    if (!timestamp) {
+        return "-";
+    }
+    char buf[32];
+    const auto t = (std::time_t)timestamp;
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", std::gmtime(&t));
+    return buf;
+}
+
+// nearest rank
+auto percentile(std::vector<u32> values, u32 p) -> u32 {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const auto rank = std::max<u64>(1, (values.size() * p + 99) / 100);
+    return values[rank - 1];
+}
+
+template<typename F>
+auto collect(const Group& group, F&& value) -> std::vector<u32> {
+    std::vector<u32> out;
+    for (const auto r : group.records) {
+        out.push_back(value(*r));
+    }
+    return out;
+}
+
+void print_bits(u64 bits) {
+    for (u32 i = 0; i < 64; i++) {
+        if (bits & (1ULL << i)) {
+            std::printf(" %u", i);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    u32 threshold = 25;
+    int arg = 1;
+    if (argc > 2 && !std::strcmp(argv[arg], "-threshold")) {
+        threshold = std::strtoul(argv[arg + 1], nullptr, 10);
+        arg += 2;
+    }
+    if (argc - arg < 1) {
+        std::fprintf(stderr, "usage: %s [-threshold percent] <history.bin>\n", argv[0]);
+        return 1;
+    }
+
+    auto f = std::fopen(argv[arg], "rb");
+    if (!f) {
+        std::perror(argv[arg]);
+        return 1;
+    }
+
+    std::vector<u8> data;
+    u8 buf[0x1000];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    std::fclose(f);
+
+    const auto header = history_validate(data.data(), data.size());
+    if (!header) {
+        std::fprintf(stderr, "%s: not a history file (or unsupported version)\n", argv[arg]);
+        return 1;
+    }
+
+    std::vector<const HistoryRecord*> records;
+    for (u32 i = 0; i < header->record_count; i++) {
+        const auto r = history_record(header, i);
+        if (r->sequence) {
+            records.push_back(r);
+        }
+    }
+    std::sort(records.begin(), records.end(), [](auto a, auto b) { return a->sequence < b->sequence; });
+
+    std::printf("%6s %-16s %-8s %-8s %-24s %6s %9s %9s %9s %10s %6s %7s %5s %s\n",
+        "seq", "date (utc)", "fw", "ams", "version", "flags", "patch_ms", "scan_ms", "first_ms", "bytes", "reads", "queries", "found", "unpatched");
+    for (const auto r : records) {
+        char flags[7] = "------";
+        const char names[] = "erdmtb";
+        for (u32 i = 0; i < 6; i++) {
+            if (r->flags & (1 << i)) {
+                flags[i] = names[i];
+            }
+        }
+        std::printf("%6llu %-16s %-8s %-8s %-24.*s %6s %9.3f %9.3f %9.3f %10llu %6u %7u %2u/%-2u",
+            (unsigned long long)r->sequence, date_str(r->timestamp).c_str(),
+            version_str(r->fw_version).c_str(), version_str(r->ams_version).c_str(),
+            (int)sizeof(r->syspatch_version), r->syspatch_version, flags,
+            r->patch_time_us / 1e3, r->start_to_scan_us / 1e3, r->start_to_first_patch_us / 1e3,
+            (unsigned long long)r->bytes_read, r->reads, r->queries,
+            __builtin_popcountll(r->patched), r->pattern_count);
+        print_bits(r->unpatched);
+        std::printf("\n");
+    }
+    std::printf("flags: e=emummc r=rescan d=pattern database m=match all t=timed out b=benchmark\n\n");
+
+    // rescans only retry what wasn't patched and benchmarks warm the scan up, so they'd skew the times
+    std::vector<Group> groups;
+    for (const auto r : records) {
+        if (r->flags & (HistoryFlag_Rescan | HistoryFlag_Benchmark)) {
+            continue;
+        }
+        const std::string version{r->syspatch_version, strnlen(r->syspatch_version, sizeof(r->syspatch_version))};
+        if (groups.empty() || groups.back().version != version || groups.back().fw_version != r->fw_version) {
+            groups.push_back({ version, r->fw_version, {}, ~0ULL });
+        }
+        groups.back().records.push_back(r);
+        groups.back().always_patched &= r->patched;
+    }
+
+    std::printf("%-24s %-8s %5s %9s %9s %9s %9s %9s\n", "version", "fw", "boots", "patch_p50", "patch_p90", "patch_max", "first_p50", "bytes_p50");
+    for (const auto& g : groups) {
+        const auto patch = collect(g, [](const HistoryRecord& r) { return r.patch_time_us; });
+        const auto first = collect(g, [](const HistoryRecord& r) { return r.start_to_first_patch_us; });
+        const auto bytes = collect(g, [](const HistoryRecord& r) { return (u32)std::min<u64>(r.bytes_read, UINT32_MAX); });
+        std::printf("%-24s %-8s %5zu %9.3f %9.3f %9.3f %9.3f %9u\n", g.version.c_str(), version_str(g.fw_version).c_str(), g.records.size(),
+            percentile(patch, 50) / 1e3, percentile(patch, 90) / 1e3, percentile(patch, 100) / 1e3, percentile(first, 50) / 1e3, percentile(bytes, 50));
+    }
+
+    u32 regressions{};
+    std::printf("\n");
+    for (u32 i = 1; i < groups.size(); i++) {
+        const auto& prev = groups[i - 1];
+        const auto& cur = groups[i];
+        const auto prev_p50 = percentile(collect(prev, [](const HistoryRecord& r) { return r.patch_time_us; }), 50);
+        const auto cur_p50 = percentile(collect(cur, [](const HistoryRecord& r) { return r.patch_time_us; }), 50);
+
+        if ((u64)cur_p50 * 100 > (u64)prev_p50 * (100 + threshold)) {
+            regressions++;
+            std::printf("regression: patch_p50 %.3fms -> %.3fms (%s %s -> %s %s)\n", prev_p50 / 1e3, cur_p50 / 1e3,
+                prev.version.c_str(), version_str(prev.fw_version).c_str(), cur.version.c_str(), version_str(cur.fw_version).c_str());
+        }
+
+        // only comparable if the patterns are the same ones
+        const auto lost = prev.always_patched & ~cur.always_patched;
+        if (lost && prev.records.back()->pattern_count == cur.records.front()->pattern_count) {
+            regressions++;
+            std::printf("regression: patterns no longer always patched (%s %s -> %s %s):", prev.version.c_str(), version_str(prev.fw_version).c_str(),
+                cur.version.c_str(), version_str(cur.fw_version).c_str());
+            print_bits(lost);
+            std::printf("\n");
+        }
+    }
+
+    if (!regressions) {
+        std::printf("no regressions\n");
+    }
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// runs the sysmod's scanner (see scanner.hpp) on a pc, against images in memory
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+#include "pattern_db.hpp"
+#include "scanner.hpp"
+
+// an image in memory, such as a loaded nso. patches are written to the image.
+struct ImageTarget {
+    std::span<u8> image;
+    u64 base{}; // address of image[0]
+
+    auto read(void* out, u64 addr, u64 size) -> bool {
+        if (addr < base || addr - base > image.size() || size > image.size() - (addr - base)) {
+            return false;
+        }
+        std::memcpy(out, image.data() + (addr - base), size);
+        return true;
+    }
+
+    auto write(const void* data, u64 addr, u64 size) -> bool {
+        if (addr < base || addr - base > image.size() || size > image.size() - (addr - base)) {
+            return false;
+        }
+        std::memcpy(image.data() + (addr - base), data, size);
+        return true;
+    }
+
+    auto ticks() -> u64 {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+};
+
+// a title of the pattern database, the patterns point into the database
+struct HostTitle {
+    std::string name;
+    u64 title_id{};
+    u32 min_fw{};
+    u32 max_fw{};
+    std::vector<Patterns> patterns;
+};
+
+inline auto host_read_file(const char* path, std::vector<u8>& out) -> bool {
+    auto f = std::fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    u8 buf[0x10000];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+        out.insert(out.end(), buf, buf + n);
+    }
+    std::fclose(f);
+    return true;
+}
+
+// loads the titles of a pattern database, data must outlive them
+inline auto host_load_pattern_db(const std::vector<u8>& data, std::vector<HostTitle>& out) -> bool {
+    const auto header = pattern_db_validate(data.data(), data.size());
+    if (!header) {
+        return false;
+    }
+
+    const auto titles = pattern_db_table<PatternDbTitle>(header, header->titles_offset);
+    const auto patterns = pattern_db_table<PatternDbPattern>(header, header->patterns_offset);
+    const auto pattern_data = pattern_db_table<u8>(header, header->data_offset);
+
+    out.clear();
+    for (u32 t = 0; t < header->title_count; t++) {
+        const auto& title = titles[t];
+        out.push_back({ std::string{title.name, strnlen(title.name, sizeof(title.name))}, title.title_id, title.min_fw, title.max_fw, {} });
+    }
+
+    for (u32 id = 0; id < header->pattern_count; id++) {
+        const auto& src = patterns[id];
+        if (src.title >= header->title_count || !pattern_db_check_data(header, src, pattern_data) ||
+            !pattern_db_check_module(header, src, pattern_data) || src.name[sizeof(src.name) - 1] ||
+            src.cond >= CondId::COUNT || src.patch >= PatchId::COUNT || src.applied >= AppliedId::COUNT) {
+            return false;
+        }
+        Patterns dst{};
+        dst.patch_name = src.name;
+        dst.byte_pattern = PatternData{ pattern_data + src.data_offset, pattern_db_info(src) };
+        dst.inst_offset = src.inst_offset;
+        dst.patch_offset = src.patch_offset;
+        dst.cond = src.cond;
+        dst.patch = src.patch;
+        dst.applied = src.applied;
+        dst.min_fw_ver = src.min_fw;
+        dst.max_fw_ver = src.max_fw;
+        dst.min_ams_ver = src.min_ams;
+        dst.max_ams_ver = src.max_ams;
+        dst.expected_count = src.expected_count ? src.expected_count : 1;
+        if (src.parent < header->pattern_count) {
+            dst.parent = patterns[src.parent].name;
+            dst.window = src.window;
+        }
+        if (src.module_offset != PATTERN_DB_NO_MODULE) {
+            dst.module = (const char*)pattern_data + src.module_offset;
+        }
+        out[src.title].patterns.push_back(dst);
+    }
+
+    return true;
+}
+
+// marks the patterns that aren't for fw as SKIPPED, as the sysmod does with version skip
+inline void host_skip_versions(std::span<const Patterns> patterns, std::span<PatternResult> results, u32 fw) {
+    for (u32 i = 0; i < patterns.size() && i < results.size(); i++) {
+        const auto& p = patterns[i];
+        if ((p.min_fw_ver && p.min_fw_ver > fw) || (p.max_fw_ver && p.max_fw_ver < fw)) {
+            results[i].result = PatchedResult::SKIPPED;
+        }
+    }
+}
+
+// scans the code of an image for the patterns, as the sysmod does for a process.
+// results has one entry per pattern, the matches are patched in the image.
+// an image is a title's own code, so patterns limited to a module aren't searched for.
+inline void host_scan(ImageTarget& target, std::span<const u8> code, u64 code_addr, std::span<const Patterns> patterns, std::span<PatternResult> results, bool match_all) {
+    static thread_local Scanner scanner;
+    static thread_local u8 window_buffer[WINDOW_BUFFER_SIZE];
+
+    scanner.window_buffer = window_buffer;
+    if (scanner_init(scanner, patterns, results, match_all)) {
+        scanner.region_addr = code_addr;
+        scanner.region_end = code_addr + code.size();
+        scanner_scan(scanner, target, code, code.size(), code_addr);
+        scanner_finish(scanner, target);
+    }
+}
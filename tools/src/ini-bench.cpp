@@ -0,0 +1,100 @@
+// measures how many filesystem calls the config / log writes take on boot,
+// using the host minGlue backend. a latency can be added to every call to
+// simulate ipc / sd card cost.
+// usage: ini-bench [root_dir] [latency_us] [patterns]
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "minIni/minIni.h"
+#include "config.hpp"
+
+namespace {
+
+void print_stats(const char* name) {
+    const auto s = ini_glue_stats();
+    std::printf("%-22s opens=%-4u reads=%-5u writes=%-4u renames=%-3u removes=%-3u read=%-7llu written=%-6llu time=%.3fms\n",
+        name, s->file_opens, s->reads, s->writes, s->renames, s->removes,
+        (unsigned long long)s->bytes_read, (unsigned long long)s->bytes_written, s->time_ns / 1e6);
+    ini_glue_stats_reset();
+}
+
+// what the sysmod did before batching: haskey + getl (+ putl) per option
+void config_per_key() {
+    ini_remove(CONFIG_PATH);
+    for (const auto& option : CONFIG_OPTIONS) {
+        if (!ini_haskey(option.section, option.key, CONFIG_PATH)) {
+            ini_putl(option.section, option.key, 1, CONFIG_PATH);
+        } else {
+            ini_getl(option.section, option.key, 1, CONFIG_PATH);
+        }
+    }
+}
+
+void config_batched(char* buffer, int size) {
+    ini_remove(CONFIG_PATH);
+    Config config{};
+    const auto missing = config_load(config);
+    config_write(config, missing, buffer, size);
+}
+
+void log_per_key(int patterns) {
+    char key[32];
+    ini_remove(LOG_PATH);
+    for (int i = 0; i < patterns; i++) {
+        std::snprintf(key, sizeof(key), "pattern%d", i);
+        ini_puts(i & 1 ? "fs" : "es", key, "Patched (sys-patch)", LOG_PATH);
+    }
+    for (int i = 0; i < 11; i++) {
+        std::snprintf(key, sizeof(key), "stat%d", i);
+        ini_puts("stats", key, "1.2.3", LOG_PATH);
+    }
+}
+
+void log_batched(int patterns, char* buffer, int size) {
+    char key[32];
+    INI_BATCH log{};
+    ini_batch_begin(&log, buffer, size, true, LOG_PATH);
+    for (int i = 0; i < patterns; i++) {
+        std::snprintf(key, sizeof(key), "pattern%d", i);
+        ini_batch_puts(&log, i & 1 ? "fs" : "es", key, "Patched (sys-patch)");
+    }
+    for (int i = 0; i < 11; i++) {
+        std::snprintf(key, sizeof(key), "stat%d", i);
+        ini_batch_puts(&log, "stats", key, "1.2.3");
+    }
+    if (!ini_batch_commit(&log)) {
+        std::printf("log did not fit in the batch buffer\n");
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const char* root = argc > 1 ? argv[1] : "ini-bench-root";
+    const u64 latency_us = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
+    const int patterns = argc > 3 ? std::atoi(argv[3]) : 13;
+    static char buffer[0x4000];
+
+    char path[512];
+    std::snprintf(path, sizeof(path), "%s/config", root);
+    mkdir(root, 0755);
+    mkdir(path, 0755);
+    std::snprintf(path, sizeof(path), "%s/config/sys-patch", root);
+    mkdir(path, 0755);
+
+    ini_host_set_root(root);
+    ini_host_set_latency(latency_us * 1000);
+    ini_glue_stats_reset();
+
+    std::printf("root=%s latency=%lluus patterns=%d block_size=%d\n", root, (unsigned long long)latency_us, patterns, INI_BLOCK_SIZE);
+    config_per_key();
+    print_stats("config (per key)");
+    config_batched(buffer, sizeof(buffer));
+    print_stats("config (batched)");
+    log_per_key(patterns);
+    print_stats("log (per key)");
+    log_batched(patterns, buffer, sizeof(buffer));
+    print_stats("log (batched)");
+    ini_fs_exit();
+    return 0;
+}
@@ -0,0 +1,165 @@
+// loads nsos as the loader would and scans them with the sysmod's scanner and a
+// pattern database, without writing the decompressed files anywhere.
+// usage: nso-scan [-fw x.y.z] [-first] <patterns.bin> [title=]<nso>...
+//  title is the name of a title in the database (eg, fs=exefs/main), without it the
+//  patterns of every title are searched for.
+//  -fw skips the patterns that aren't for that fw, and picks the version dependent conds.
+//  -first patches the first matches, rather than only patching once the whole file
+//  has been scanned (the sysmod's match all mode, which is the default here).
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nso.hpp"
+#include "host_scan.hpp"
+
+namespace {
+
+struct Job {
+    NsoImage* nso;
+    const HostTitle* title;
+    std::vector<PatternResult> results;
+    double scan_ms;
+};
+
+auto parse_version(const char* s, u32& out) -> bool {
+    unsigned major{}, minor{}, micro{};
+    if (std::sscanf(s, "%u.%u.%u", &major, &minor, &micro) < 1) {
+        return false;
+    }
+    out = (major << 16) | (minor << 8) | micro;
+    return true;
+}
+
+auto ms_since(std::chrono::steady_clock::time_point start) -> double {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    u32 fw{};
+    bool match_all{true};
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!std::strcmp(argv[arg], "-fw") && arg + 1 < argc && parse_version(argv[arg + 1], fw)) {
+            arg++;
+        } else if (!std::strcmp(argv[arg], "-first")) {
+            match_all = false;
+        } else {
+            argc = 0;
+        }
+    }
+
+    if (argc - arg < 2) {
+        std::fprintf(stderr, "usage: %s [-fw x.y.z] [-first] <patterns.bin> [title=]<nso>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<u8> db;
+    std::vector<HostTitle> titles;
+    if (!host_read_file(argv[arg], db)) {
+        std::perror(argv[arg]);
+        return 1;
+    }
+    if (!host_load_pattern_db(db, titles)) {
+        std::fprintf(stderr, "%s: not a pattern database (or unsupported version)\n", argv[arg]);
+        return 1;
+    }
+    if (fw) {
+        inst_init(fw);
+    }
+
+    // title= is only taken as a title if the database has one by that name
+    std::vector<NsoImage> nsos;
+    std::vector<const HostTitle*> nso_titles;
+    for (arg++; arg < argc; arg++) {
+        const HostTitle* title{};
+        std::string path = argv[arg];
+        if (const auto eq = path.find('='); eq != std::string::npos) {
+            for (const auto& t : titles) {
+                if (t.name == path.substr(0, eq)) {
+                    title = &t;
+                    path = path.substr(eq + 1);
+                    break;
+                }
+            }
+        }
+        nsos.push_back({ path });
+        nso_titles.push_back(title);
+    }
+
+    const auto load_start = std::chrono::steady_clock::now();
+    nso_load_all(nsos);
+    const auto load_ms = ms_since(load_start);
+
+    std::vector<Job> jobs;
+    for (u32 n = 0; n < nsos.size(); n++) {
+        if (!nsos[n].ok()) {
+            continue;
+        }
+        for (const auto& title : titles) {
+            if (nso_titles[n] && nso_titles[n] != &title) {
+                continue;
+            }
+            if (fw && ((title.min_fw && title.min_fw > fw) || (title.max_fw && title.max_fw < fw))) {
+                continue;
+            }
+            jobs.push_back({ &nsos[n], &title, std::vector<PatternResult>(title.patterns.size()), 0 });
+        }
+    }
+
+    // every job patches its own copy of the image, so the results don't depend on each other
+    const auto scan_start = std::chrono::steady_clock::now();
+    parallel_for(jobs.size(), [&](size_t i) {
+        auto& job = jobs[i];
+        const auto start = std::chrono::steady_clock::now();
+        auto image = job.nso->image;
+        const auto& text = job.nso->header.text;
+        ImageTarget target{ image, 0 };
+
+        if (fw) {
+            host_skip_versions(job.title->patterns, job.results, fw);
+        }
+        host_scan(target, { image.data() + text.memory_offset, text.size }, text.memory_offset, job.title->patterns, job.results, match_all);
+        job.scan_ms = ms_since(start);
+    });
+    const auto scan_ms = ms_since(scan_start);
+
+    int rc = 0;
+    for (auto& nso : nsos) {
+        if (!nso.ok()) {
+            std::fprintf(stderr, "%s: %s\n", nso.path.c_str(), nso.error.c_str());
+            rc = 1;
+            continue;
+        }
+
+        const auto& h = nso.header;
+        std::printf("%s: build_id=%s text=0x%x ro=0x%x data=0x%x bss=0x%x mod0=", nso.path.c_str(), nso.build_id_str().c_str(), h.text.size, h.ro.size, h.data.size, h.bss_size);
+        if (nso.mod0_offset) {
+            std::printf("0x%x\n", nso.mod0_offset);
+        } else {
+            std::printf("none\n");
+        }
+
+        for (const auto& job : jobs) {
+            if (job.nso != &nso) {
+                continue;
+            }
+
+            u32 found{};
+            for (u32 i = 0; i < job.results.size(); i++) {
+                const auto& r = job.results[i];
+                found += r.result == PatchedResult::PATCHED_SYSPATCH || r.result == PatchedResult::PATCHED_FILE;
+                std::printf("  %-8s %-24s %-36s addr=%08llx matches=%u\n",
+                    job.title->name.c_str(), job.title->patterns[i].patch_name,
+                    patch_result_to_str(r.result), (unsigned long long)r.addr, r.match_count);
+            }
+            std::printf("  %-8s found %u/%zu in %.3fms\n", job.title->name.c_str(), found, job.results.size(), job.scan_ms);
+        }
+    }
+
+    std::printf("loaded %zu nsos in %.3fms, scanned in %.3fms\n", nsos.size(), load_ms, scan_ms);
+    return rc;
+}
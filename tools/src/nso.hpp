@@ -0,0 +1,288 @@
+#pragma once
+
+// loads NSOs (the executables in a title's exefs) into memory as the loader lays
+// them out, so the host tools see the same bytes as the sysmod does.
+// the segments of every file are decompressed in parallel.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include "minIni/minGlue.h" // for the u8-u64 types
+
+// calls fn(i) for every i in [0, count), spread over every core
+template<typename F>
+void parallel_for(size_t count, F&& fn) {
+    std::atomic<size_t> next{};
+    const auto worker = [&] {
+        for (size_t i; (i = next++) < count;) {
+            fn(i);
+        }
+    };
+
+    const auto thread_count = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()), count);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+constexpr u32 NSO_MAGIC = 0x304F534E; // "NSO0"
+constexpr u32 MOD0_MAGIC = 0x30444F4D; // "MOD0"
+constexpr u64 NSO_PAGE_SIZE = 0x1000;
+
+enum NsoSegmentId : u32 { NsoSegment_Text, NsoSegment_Ro, NsoSegment_Data, NsoSegment_Count };
+
+struct NsoSegmentHeader {
+    u32 file_offset;
+    u32 memory_offset;
+    u32 size; // decompressed
+};
+
+struct NsoHeader {
+    u32 magic; // NSO_MAGIC
+    u32 version;
+    u32 reserved;
+    u32 flags; // bit n: segment n is lz4 compressed, bit n + 3: segment n is hashed
+    NsoSegmentHeader text;
+    u32 module_name_offset;
+    NsoSegmentHeader ro;
+    u32 module_name_size;
+    NsoSegmentHeader data;
+    u32 bss_size;
+    u8 build_id[0x20];
+    u32 file_size[NsoSegment_Count]; // compressed
+    u8 reserved2[0x1C];
+    u32 api_info_offset;
+    u32 api_info_size;
+    u32 dynstr_offset;
+    u32 dynstr_size;
+    u32 dynsym_offset;
+    u32 dynsym_size;
+    u8 hash[NsoSegment_Count][0x20];
+
+    auto segment(u32 id) const -> const NsoSegmentHeader& {
+        return id == NsoSegment_Text ? text : id == NsoSegment_Ro ? ro : data;
+    }
+};
+
+static_assert(sizeof(NsoHeader) == 0x100);
+
+// offsets are relative to the start of the header
+struct Mod0Header {
+    u32 magic; // MOD0_MAGIC
+    s32 dynamic_offset;
+    s32 bss_start_offset;
+    s32 bss_end_offset;
+    s32 eh_frame_hdr_start_offset;
+    s32 eh_frame_hdr_end_offset;
+    s32 module_object_offset;
+};
+
+struct NsoImage {
+    std::string path;
+    std::string error; // empty if loaded
+    NsoHeader header{};
+    std::vector<u8> file;
+    std::vector<u8> image; // the segments at their memory offsets, followed by bss
+    u32 mod0_offset{}; // 0 if there's no MOD0
+    Mod0Header mod0{};
+
+    auto ok() const -> bool {
+        return error.empty();
+    }
+
+    // the gnu build id, which is what atmosphère's exefs patches are named after.
+    // it's the first 0x14 bytes of the build id, the rest is padding.
+    auto build_id_str() const -> std::string {
+        char buf[0x14 * 2 + 1]{};
+        for (u32 i = 0; i < 0x14; i++) {
+            std::snprintf(buf + i * 2, 3, "%02X", header.build_id[i]);
+        }
+        return buf;
+    }
+
+    auto segment(u32 id) const -> std::span<const u8> {
+        const auto& seg = header.segment(id);
+        return {image.data() + seg.memory_offset, seg.size};
+    }
+};
+
+// decompresses an lz4 block, returns false if it's invalid or doesn't fill out exactly
+inline auto lz4_decompress(const u8* src, u64 src_size, u8* dst, u64 dst_size) -> bool {
+    const auto src_end = src + src_size;
+    const auto dst_start = dst;
+    const auto dst_end = dst + dst_size;
+
+    const auto read_length = [&](u64& len) -> bool {
+        for (u8 b = 0xFF; b == 0xFF;) {
+            if (src == src_end) {
+                return false;
+            }
+            b = *src++;
+            len += b;
+        }
+        return true;
+    };
+
+    while (src < src_end) {
+        const auto token = *src++;
+
+        u64 literals = token >> 4;
+        if (literals == 0xF && !read_length(literals)) {
+            return false;
+        }
+        if (literals > (u64)(src_end - src) || literals > (u64)(dst_end - dst)) {
+            return false;
+        }
+        std::memcpy(dst, src, literals);
+        src += literals;
+        dst += literals;
+
+        // the last sequence has no match
+        if (src == src_end) {
+            break;
+        }
+
+        if (src_end - src < 2) {
+            return false;
+        }
+        const u64 offset = src[0] | (src[1] << 8);
+        src += 2;
+        u64 match = token & 0xF;
+        if (match == 0xF && !read_length(match)) {
+            return false;
+        }
+        match += 4;
+        if (!offset || offset > (u64)(dst - dst_start) || match > (u64)(dst_end - dst)) {
+            return false;
+        }
+
+        // may overlap, so copied a byte at a time
+        const auto from = dst - offset;
+        for (u64 i = 0; i < match; i++) {
+            dst[i] = from[i];
+        }
+        dst += match;
+    }
+
+    return dst == dst_end;
+}
+
+// reads the file and checks the header, the segments are loaded by nso_load_segment()
+inline void nso_open(NsoImage& nso) {
+    auto f = std::fopen(nso.path.c_str(), "rb");
+    if (!f) {
+        nso.error = std::strerror(errno);
+        return;
+    }
+
+    u8 buf[0x10000];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+        nso.file.insert(nso.file.end(), buf, buf + n);
+    }
+    std::fclose(f);
+
+    if (nso.file.size() < sizeof(NsoHeader)) {
+        nso.error = "too small to be an nso";
+        return;
+    }
+    std::memcpy(&nso.header, nso.file.data(), sizeof(NsoHeader));
+    if (nso.header.magic != NSO_MAGIC) {
+        nso.error = "not an nso";
+        return;
+    }
+
+    u64 image_size{};
+    for (u32 id = 0; id < NsoSegment_Count; id++) {
+        const auto& seg = nso.header.segment(id);
+        const u64 file_size = nso.header.flags & (1 << id) ? nso.header.file_size[id] : seg.size;
+        if ((u64)seg.file_offset + file_size > nso.file.size()) {
+            nso.error = "segment is outside of the file";
+            return;
+        }
+        image_size = std::max<u64>(image_size, (u64)seg.memory_offset + seg.size);
+    }
+
+    image_size = (image_size + nso.header.bss_size + NSO_PAGE_SIZE - 1) & ~(NSO_PAGE_SIZE - 1);
+    nso.image.resize(image_size);
+}
+
+inline void nso_load_segment(NsoImage& nso, u32 id, std::string& error) {
+    const auto& seg = nso.header.segment(id);
+    const auto src = nso.file.data() + seg.file_offset;
+    const auto dst = nso.image.data() + seg.memory_offset;
+
+    if (nso.header.flags & (1 << id)) {
+        if (!lz4_decompress(src, nso.header.file_size[id], dst, seg.size)) {
+            error = "segment failed to decompress";
+        }
+    } else {
+        std::memcpy(dst, src, seg.size);
+    }
+}
+
+// finds MOD0, which the start of text points to
+inline void nso_find_mod0(NsoImage& nso) {
+    u32 offset{};
+    const auto text = nso.segment(NsoSegment_Text);
+    if (text.size() < 8) {
+        return;
+    }
+
+    std::memcpy(&offset, text.data() + 4, sizeof(offset));
+    if ((u64)offset + sizeof(Mod0Header) <= nso.image.size()) {
+        Mod0Header mod0;
+        std::memcpy(&mod0, nso.image.data() + offset, sizeof(mod0));
+        if (mod0.magic == MOD0_MAGIC) {
+            nso.mod0_offset = offset;
+            nso.mod0 = mod0;
+        }
+    }
+}
+
+// loads every file, the segments are decompressed on all cores.
+// a file that fails to load has its error set, the rest are still loaded.
+inline void nso_load_all(std::vector<NsoImage>& nsos) {
+    for (auto& nso : nsos) {
+        nso_open(nso);
+    }
+
+    // one job per segment of every file, errors are kept per job so that threads don't share them
+    struct Job {
+        NsoImage* nso;
+        u32 id;
+        std::string error;
+    };
+    std::vector<Job> jobs;
+    for (auto& nso : nsos) {
+        for (u32 id = 0; nso.ok() && id < NsoSegment_Count; id++) {
+            jobs.push_back({ &nso, id, {} });
+        }
+    }
+
+    parallel_for(jobs.size(), [&](size_t i) {
+        nso_load_segment(*jobs[i].nso, jobs[i].id, jobs[i].error);
+    });
+
+    for (auto& job : jobs) {
+        if (!job.error.empty() && job.nso->ok()) {
+            job.nso->error = job.error;
+        }
+    }
+    for (auto& nso : nsos) {
+        if (nso.ok()) {
+            nso_find_mod0(nso);
+        }
+        // only the image is needed from here on
+        nso.file = {};
+    }
+}
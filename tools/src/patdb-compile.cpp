@@ -0,0 +1,381 @@
+// compiles the text pattern source into the binary database read by the sysmod.
+// usage: patdb-compile <patterns.txt> <patterns.bin>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "pattern.hpp"
+#include "pattern_db.hpp"
+
+namespace {
+
+// these match the limits of the sysmod, the database is still written if exceeded
+// but the sysmod will fall back to its built-in patterns.
+constexpr u32 SYSMOD_MAX_TITLES = 16;
+constexpr u32 SYSMOD_MAX_PATTERNS = 64;
+constexpr u32 SYSMOD_MAX_WINDOW = 0x400;
+
+struct Title {
+    std::string name;
+    u64 title_id{};
+    u32 min_fw{};
+    u32 max_fw{};
+};
+
+struct Pattern {
+    std::string name;
+    PatternInfo info{};
+    std::vector<u8> data; // as written by pattern_parse()
+    u16 title{};
+    s32 inst_offset{};
+    s32 patch_offset{};
+    CondId cond{};
+    PatchId patch{};
+    AppliedId applied{};
+    u32 min_fw{};
+    u32 max_fw{};
+    u32 min_ams{};
+    u32 max_ams{};
+    u8 expected_count{1};
+    std::string parent;
+    u16 window{};
+    std::string module; // empty for the title's own code
+};
+
+struct Source {
+    std::vector<Title> titles;
+    std::vector<Pattern> patterns;
+};
+
+// "-" or x.y.z
+auto parse_version(const std::string& s, u32& out) -> bool {
+    u32 major{}, minor{}, micro{};
+    if (s == "-") {
+        out = 0;
+        return true;
+    }
+    if (std::sscanf(s.c_str(), "%u.%u.%u", &major, &minor, &micro) != 3 || major > 0xFF || minor > 0xFF || micro > 0xFF) {
+        return false;
+    }
+    out = (major << 16) | (minor << 8) | micro;
+    return true;
+}
+
+template<typename T, size_t N>
+auto parse_id(const std::string& s, const char* const (&names)[N], T& out) -> bool {
+    for (size_t i = 0; i < N; i++) {
+        if (s == names[i]) {
+            out = (T)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+auto parse_source(const char* path, Source& src) -> bool {
+    auto f = std::fopen(path, "r");
+    if (!f) {
+        std::perror(path);
+        return false;
+    }
+
+    char line_buf[0x200];
+    u32 line_no{};
+    bool ok = true;
+    while (ok && std::fgets(line_buf, sizeof(line_buf), f)) {
+        line_no++;
+        std::istringstream line{line_buf};
+        std::vector<std::string> tok;
+        for (std::string t; line >> t && t[0] != '#';) {
+            tok.emplace_back(t);
+        }
+        if (tok.empty()) {
+            continue;
+        }
+
+        const auto error = [&](const char* msg) {
+            std::fprintf(stderr, "%s:%u: %s\n", path, line_no, msg);
+            ok = false;
+        };
+
+        if (tok[0] == "title") {
+            Title t{};
+            if (tok.size() < 3 || tok.size() > 5) {
+                error("expected: title <name> <title_id> [min_fw] [max_fw]");
+            } else if (tok[1].size() >= sizeof(PatternDbTitle::name)) {
+                error("title name is too long");
+            } else if (!(t.title_id = std::strtoull(tok[2].c_str(), nullptr, 16))) {
+                error("invalid title id");
+            } else if ((tok.size() > 3 && !parse_version(tok[3], t.min_fw)) || (tok.size() > 4 && !parse_version(tok[4], t.max_fw))) {
+                error("invalid version");
+            } else {
+                t.name = tok[1];
+                src.titles.emplace_back(t);
+            }
+            continue;
+        }
+
+        // count=N, parent=<name>, window=N and module=<name> can be given anywhere after the pattern name
+        Pattern p{};
+        char* end{};
+        for (auto it = tok.begin() + 1; ok && it != tok.end();) {
+            if (it->starts_with("count=")) {
+                const auto count = std::strtoul(it->c_str() + 6, &end, 0);
+                if (*end || !count || count > 0xFF) {
+                    error("invalid count");
+                }
+                p.expected_count = count;
+            } else if (it->starts_with("parent=")) {
+                p.parent = it->substr(7);
+            } else if (it->starts_with("window=")) {
+                const auto window = std::strtoul(it->c_str() + 7, &end, 0);
+                if (*end || window > SYSMOD_MAX_WINDOW) {
+                    error("invalid window");
+                }
+                p.window = window;
+            } else if (it->starts_with("module=")) {
+                p.module = it->substr(7);
+                if (p.module.empty() || p.module.size() >= PATTERN_DB_MODULE_MAX_SIZE) {
+                    error("invalid module");
+                }
+            } else {
+                ++it;
+                continue;
+            }
+            it = tok.erase(it);
+        }
+
+        if (!ok) {
+            continue;
+        } else if (src.titles.empty()) {
+            error("pattern before the first title");
+        } else if (tok.size() < 7 || tok.size() > 11) {
+            error("expected: <name> <pattern> <inst_offset> <patch_offset> <cond> <patch> <applied> [min_fw] [max_fw] [min_ams] [max_ams]");
+        } else if (tok[0].size() >= sizeof(PatternDbPattern::name)) {
+            error("pattern name is too long");
+        } else if (p.info = pattern_parse(tok[1].c_str()); !p.info.ok && p.info.size && !p.info.anchor_size) {
+            error("pattern has no byte without wildcards, it would match everywhere");
+        } else if (!p.info.ok) {
+            error("invalid pattern");
+        } else if (p.inst_offset = std::strtol(tok[2].c_str(), &end, 0); *end) {
+            error("invalid inst_offset");
+        } else if (p.patch_offset = std::strtol(tok[3].c_str(), &end, 0); *end) {
+            error("invalid patch_offset");
+        } else if (!parse_id(tok[4], COND_NAMES, p.cond)) {
+            error("unknown cond");
+        } else if (!parse_id(tok[5], PATCH_NAMES, p.patch)) {
+            error("unknown patch");
+        } else if (!parse_id(tok[6], APPLIED_NAMES, p.applied)) {
+            error("unknown applied");
+        } else if ((tok.size() > 7 && !parse_version(tok[7], p.min_fw)) || (tok.size() > 8 && !parse_version(tok[8], p.max_fw)) ||
+                   (tok.size() > 9 && !parse_version(tok[9], p.min_ams)) || (tok.size() > 10 && !parse_version(tok[10], p.max_ams))) {
+            error("invalid version");
+        } else {
+            p.name = tok[0];
+            p.data.resize(p.info.bytes());
+            pattern_parse(tok[1].c_str(), p.data.data());
+            p.title = src.titles.size() - 1;
+            src.patterns.emplace_back(p);
+        }
+    }
+
+    std::fclose(f);
+
+    // parents must be in the same title and module, and can't have a parent themselves
+    for (auto& p : src.patterns) {
+        if (p.parent.empty()) {
+            continue;
+        }
+        const auto it = std::find_if(src.patterns.begin(), src.patterns.end(), [&](const Pattern& e) {
+            return e.title == p.title && e.name == p.parent;
+        });
+        if (it == src.patterns.end() || &*it == &p || !it->parent.empty() || it->module != p.module) {
+            std::fprintf(stderr, "%s: %s: parent %s must be another pattern in the same title and module without a parent\n", path, p.name.c_str(), p.parent.c_str());
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+auto in_range(u32 fw, u32 min_fw, u32 max_fw) -> bool {
+    return (!min_fw || fw >= min_fw) && (!max_fw || fw <= max_fw);
+}
+
+template<typename T>
+void append(std::vector<u8>& out, const T& v) {
+    const auto p = (const u8*)&v;
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+void print_version(u32 ver) {
+    std::printf("%u.%u.%u", (ver >> 16) & 0xFF, (ver >> 8) & 0xFF, ver & 0xFF);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <patterns.txt> <patterns.bin>\n", argv[0]);
+        return 1;
+    }
+
+    Source src{};
+    if (!parse_source(argv[1], src)) {
+        return 1;
+    }
+    if (src.titles.size() > 0xFFFF || src.patterns.size() > 0xFFFF) {
+        std::fprintf(stderr, "%s: too many titles / patterns\n", argv[1]);
+        return 1;
+    }
+
+    // the active set of patterns can only change where a version range starts or ends
+    std::set<u32> breakpoints{0};
+    const auto add_range = [&](u32 min_fw, u32 max_fw) {
+        breakpoints.insert(min_fw);
+        if (max_fw) {
+            breakpoints.insert(max_fw + 1);
+        }
+    };
+    for (const auto& t : src.titles) {
+        add_range(t.min_fw, t.max_fw);
+    }
+    for (const auto& p : src.patterns) {
+        add_range(p.min_fw, p.max_fw);
+    }
+
+    std::vector<PatternDbInterval> intervals;
+    std::vector<u16> index;
+    std::vector<u16> last;
+    for (const auto fw : breakpoints) {
+        std::vector<u16> active;
+        for (u16 i = 0; i < src.patterns.size(); i++) {
+            const auto& p = src.patterns[i];
+            const auto& t = src.titles[p.title];
+            if (in_range(fw, t.min_fw, t.max_fw) && in_range(fw, p.min_fw, p.max_fw)) {
+                active.emplace_back(i);
+            }
+        }
+
+        // merge with the previous interval if nothing changed
+        if (!intervals.empty() && active == last) {
+            continue;
+        }
+
+        intervals.push_back({ fw, (u32)index.size(), (u32)active.size() });
+        index.insert(index.end(), active.begin(), active.end());
+        last = std::move(active);
+    }
+
+    std::vector<u8> data;
+    std::vector<PatternDbPattern> patterns;
+    for (const auto& p : src.patterns) {
+        PatternDbPattern e{};
+        std::strncpy(e.name, p.name.c_str(), sizeof(e.name) - 1);
+        e.min_fw = p.min_fw;
+        e.max_fw = p.max_fw;
+        e.min_ams = p.min_ams;
+        e.max_ams = p.max_ams;
+        e.inst_offset = p.inst_offset;
+        e.patch_offset = p.patch_offset;
+        e.data_offset = data.size();
+        e.title = p.title;
+        e.size = p.info.size;
+        e.alt_count = p.info.alt_count;
+        e.anchor_offset = p.info.anchor_offset;
+        e.anchor_size = p.info.anchor_size;
+        e.cond = p.cond;
+        e.patch = p.patch;
+        e.applied = p.applied;
+        e.expected_count = p.expected_count;
+        e.parent = PATTERN_DB_NO_PARENT;
+        e.window = p.window;
+        for (u16 i = 0; i < src.patterns.size(); i++) {
+            if (!p.parent.empty() && src.patterns[i].title == p.title && src.patterns[i].name == p.parent) {
+                e.parent = i;
+            }
+        }
+        data.insert(data.end(), p.data.begin(), p.data.end());
+
+        e.module_offset = PATTERN_DB_NO_MODULE;
+        if (!p.module.empty()) {
+            e.module_offset = data.size();
+            data.insert(data.end(), p.module.begin(), p.module.end());
+            data.push_back(0);
+        }
+        patterns.emplace_back(e);
+    }
+
+    PatternDbHeader header{};
+    header.magic = PATTERN_DB_MAGIC;
+    header.version = PATTERN_DB_VERSION;
+    header.header_size = sizeof(header);
+    header.title_count = src.titles.size();
+    header.pattern_count = patterns.size();
+    header.interval_count = intervals.size();
+    header.index_count = index.size();
+    header.data_size = data.size();
+    header.titles_offset = sizeof(header);
+    header.patterns_offset = header.titles_offset + header.title_count * sizeof(PatternDbTitle);
+    header.intervals_offset = header.patterns_offset + header.pattern_count * sizeof(PatternDbPattern);
+    header.index_offset = header.intervals_offset + header.interval_count * sizeof(PatternDbInterval);
+    header.data_offset = header.index_offset + header.index_count * sizeof(u16);
+    header.file_size = header.data_offset + header.data_size;
+
+    std::vector<u8> out;
+    append(out, header);
+    for (const auto& t : src.titles) {
+        PatternDbTitle e{};
+        e.title_id = t.title_id;
+        std::strncpy(e.name, t.name.c_str(), sizeof(e.name) - 1);
+        e.min_fw = t.min_fw;
+        e.max_fw = t.max_fw;
+        append(out, e);
+    }
+    for (const auto& e : patterns) {
+        append(out, e);
+    }
+    for (const auto& e : intervals) {
+        append(out, e);
+    }
+    for (const auto& e : index) {
+        append(out, e);
+    }
+    out.insert(out.end(), data.begin(), data.end());
+
+    if (!pattern_db_validate(out.data(), out.size())) {
+        std::fprintf(stderr, "%s: generated database failed validation\n", argv[2]);
+        return 1;
+    }
+    // the sysmod would ignore it and use its built-in patterns
+    if (out.size() > PATTERN_DB_MAX_FILE_SIZE) {
+        std::fprintf(stderr, "%s: %zu bytes is over the sysmod's limit of %u\n", argv[2], out.size(), PATTERN_DB_MAX_FILE_SIZE);
+        return 1;
+    }
+
+    auto f = std::fopen(argv[2], "wb");
+    if (!f || std::fwrite(out.data(), 1, out.size(), f) != out.size() || std::fclose(f)) {
+        std::perror(argv[2]);
+        return 1;
+    }
+
+    std::printf("%s: %zu titles, %zu patterns, %zu intervals, %zu bytes\n", argv[2], src.titles.size(), patterns.size(), intervals.size(), out.size());
+    for (const auto& e : intervals) {
+        std::printf("  fw ");
+        print_version(e.min_fw);
+        std::printf("+: %u patterns", e.count);
+        std::set<u16> titles;
+        for (u32 i = 0; i < e.count; i++) {
+            titles.insert(src.patterns[index[e.first + i]].title);
+        }
+        if (e.count > SYSMOD_MAX_PATTERNS || titles.size() > SYSMOD_MAX_TITLES) {
+            std::printf(" (over the sysmod limit, the built-in patterns will be used)");
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+// prints a results.bin written by the sysmod.
+// usage: results-dump <results.bin>
+#include <cstdio>
+#include <vector>
+#include "results.hpp"
+
+namespace {
+
+void print_version(const char* name, u32 ver) {
+    std::printf("%s: %u.%u.%u\n", name, (ver >> 16) & 0xFF, (ver >> 8) & 0xFF, ver & 0xFF);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <results.bin>\n", argv[0]);
+        return 1;
+    }
+
+    auto f = std::fopen(argv[1], "rb");
+    if (!f) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<u8> data;
+    u8 buf[0x1000];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    std::fclose(f);
+
+    const auto header = results_validate(data.data(), data.size());
+    if (!header) {
+        std::fprintf(stderr, "%s: not a results file (or unsupported version)\n", argv[1]);
+        return 1;
+    }
+
+    std::printf("version: %.*s\n", (int)sizeof(header->syspatch_version), header->syspatch_version);
+    print_version("fw_version", header->fw_version);
+    print_version("ams_version", header->ams_version);
+    print_version("ams_target_version", header->ams_target_version);
+    std::printf("ams_keygen: %u\n", header->ams_keygen);
+    std::printf("ams_hash: %08x\n", (u32)(header->ams_hash >> 32));
+    std::printf("is_emummc: %u\n", header->is_emummc);
+    std::printf("patching_enabled: %u\n", header->patching_enabled);
+    std::printf("patch_time: %.3fs\n", header->patch_time_ns / 1e9);
+
+    for (u32 i = 0; i < header->entry_count; i++) {
+        const auto e = results_entry(header, i);
+        std::printf("%016llx %-8.*s %2u %-24.*s %-36s addr=%010llx t=%uus matches=%u pid=%llu code=%010llx\n",
+            (unsigned long long)e->title_id,
+            (int)sizeof(e->title_name), e->title_name,
+            e->pattern_id,
+            (int)sizeof(e->pattern_name), e->pattern_name,
+            patch_result_to_str(e->result),
+            (unsigned long long)e->address, e->time_us, e->match_count,
+            (unsigned long long)e->process_id, (unsigned long long)e->code_addr);
+    }
+
+    return 0;
+}
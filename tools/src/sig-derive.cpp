@@ -0,0 +1,351 @@
+// derives the shortest pattern for an instruction that's unique in the nso's text,
+// and that also matches (and is unique at) the same instruction in older dumps.
+// usage: sig-derive [-name n] [-max size] [-old <nso>:<addr>]... <nso> <addr> <cond> <patch> <applied> [patch_offset]
+//  addr is the offset of the instruction within the image, as printed by nso-scan.
+//  cond / patch / applied use the names of the pattern database source (see inst.hpp).
+// the bytes that differ between the dumps are wildcarded (eg, registers), as are the
+// parts of pc relative instructions that change whenever the code moves (relocations).
+// prints the pattern as a Patterns table entry and as a patterns.txt line.
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "nso.hpp"
+#include "pattern.hpp"
+#include "inst.hpp"
+
+namespace {
+
+constexpr u32 DEFAULT_MAX_SIZE = 0x40;
+
+// the sorted suffixes of the text, the occurrences of a string are a range of it
+struct SuffixArray {
+    std::span<const u8> text;
+    std::vector<u32> sa;
+
+    // prefix doubling, O(n log^2 n), which is a few seconds for the largest text
+    void build(std::span<const u8> t) {
+        const u32 n = t.size();
+        text = t;
+        sa.resize(n);
+        std::iota(sa.begin(), sa.end(), 0);
+
+        std::vector<u32> rank(n), tmp(n);
+        for (u32 i = 0; i < n; i++) {
+            rank[i] = t[i];
+        }
+
+        for (u32 k = 1; n > 1; k *= 2) {
+            const auto key = [&](u32 i) -> u64 {
+                return ((u64)rank[i] << 32) | (i + k < n ? rank[i + k] + 1 : 0);
+            };
+            std::sort(sa.begin(), sa.end(), [&](u32 a, u32 b) { return key(a) < key(b); });
+
+            tmp[sa[0]] = 0;
+            for (u32 i = 1; i < n; i++) {
+                tmp[sa[i]] = tmp[sa[i - 1]] + (key(sa[i - 1]) < key(sa[i]));
+            }
+            rank.swap(tmp);
+            if (rank[sa[n - 1]] == n - 1) {
+                break;
+            }
+        }
+    }
+
+    // the suffixes that start with s
+    auto find(const u8* s, u32 size) const -> std::pair<u32, u32> {
+        const auto cmp = [&](u32 pos) {
+            const auto len = std::min<u64>(size, text.size() - pos);
+            const auto r = std::memcmp(text.data() + pos, s, len);
+            return r ? r : len < size ? -1 : 0;
+        };
+        const auto lo = std::partition_point(sa.begin(), sa.end(), [&](u32 pos) { return cmp(pos) < 0; });
+        const auto hi = std::partition_point(lo, sa.end(), [&](u32 pos) { return cmp(pos) == 0; });
+        return { (u32)(lo - sa.begin()), (u32)(hi - sa.begin()) };
+    }
+};
+
+struct Dump {
+    NsoImage nso;
+    u64 addr; // of the instruction
+    SuffixArray sa;
+
+    auto text() const -> std::span<const u8> {
+        return nso.segment(NsoSegment_Text);
+    }
+};
+
+// a candidate pattern, [start, start + size) of the target's text
+struct Candidate {
+    u64 start;
+    u32 size;
+    u32 anchor_offset;
+    u32 anchor_size;
+    u32 anchor_count; // places the anchor is in the target, what the device compares the rest of the pattern at
+    u32 distance; // bytes between the pattern and the instruction
+};
+
+// the bits of an instruction that change when the code (or what it references) moves
+auto reloc_mask(u32 inst, u32 prev) -> u32 {
+    if ((inst & 0x7C000000) == 0x14000000) { return 0xFC000000; } // b / bl
+    if ((inst & 0x1F000000) == 0x10000000) { return 0x9F00001F; } // adr / adrp
+    if ((inst & 0xFF000010) == 0x54000000) { return 0xFF00001F; } // b.cond
+    if ((inst & 0x7E000000) == 0x34000000) { return 0xFF00001F; } // cbz / cbnz
+    if ((inst & 0x7E000000) == 0x36000000) { return 0xFFF8001F; } // tbz / tbnz
+    if ((inst & 0x3B000000) == 0x18000000) { return 0xFF00001F; } // ldr literal
+
+    // the page offset of an adrp, in the add / ldr / str that uses its result
+    const bool after_adrp = (prev & 0x9F000000) == 0x90000000 && ((inst >> 5) & 0x1F) == (prev & 0x1F);
+    if (after_adrp && (inst & 0x7F800000) == 0x11000000) { return 0xFFC003FF; } // add imm
+    if (after_adrp && (inst & 0x3B000000) == 0x39000000) { return 0xFFC003FF; } // ldr / str imm
+    return 0xFFFFFFFF;
+}
+
+auto matches(std::span<const u8> text, u64 pos, const u8* value, const u8* mask, u32 size) -> bool {
+    if (pos + size > text.size()) {
+        return false;
+    }
+    for (u32 i = 0; i < size; i++) {
+        if ((text[pos + i] & mask[i]) != value[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the places in the dump that the pattern matches, stopping at 2
+auto count_matches(const Dump& dump, const u8* value, const u8* mask, const Candidate& c) -> u32 {
+    const auto text = dump.text();
+    const auto [lo, hi] = dump.sa.find(value + c.anchor_offset, c.anchor_size);
+    u32 count{};
+    for (u32 i = lo; i < hi && count < 2; i++) {
+        const auto pos = dump.sa.sa[i];
+        if (pos >= c.anchor_offset && matches(text, pos - c.anchor_offset, value, mask, c.size)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+auto pattern_str(const u8* value, const u8* mask, u32 size) -> std::string {
+    std::string s = "0x";
+    char buf[16];
+    for (u32 i = 0; i < size; i++) {
+        const auto v = value[i], m = mask[i];
+        if (m == 0xFF) {
+            std::snprintf(buf, sizeof(buf), "%02X", v);
+        } else if (m == 0x00) {
+            std::snprintf(buf, sizeof(buf), ".");
+        } else if (m == 0xF0) {
+            std::snprintf(buf, sizeof(buf), "%X?", v >> 4);
+        } else if (m == 0x0F) {
+            std::snprintf(buf, sizeof(buf), "?%X", v & 0xF);
+        } else {
+            buf[0] = '[';
+            for (u32 bit = 0; bit < 8; bit++) {
+                const u8 b = 0x80 >> bit;
+                buf[1 + bit] = m & b ? (v & b ? '1' : '0') : 'x';
+            }
+            buf[9] = ']';
+            buf[10] = '\0';
+        }
+        s += buf;
+    }
+    return s;
+}
+
+auto parse_name(const char* s, const char* const* names, u32 count) -> s32 {
+    for (u32 i = 0; i < count; i++) {
+        if (!std::strcmp(s, names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+auto upper(const char* s) -> std::string {
+    std::string out = s;
+    for (auto& c : out) {
+        c = std::toupper(c);
+    }
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string name = "new_patch";
+    u32 max_size = DEFAULT_MAX_SIZE;
+    std::vector<Dump> dumps(1); // the target, then the older dumps
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const std::string opt = argv[arg];
+        if (arg + 1 == argc) {
+            argc = 0;
+        } else if (opt == "-name") {
+            name = argv[++arg];
+        } else if (opt == "-max") {
+            max_size = std::clamp<u32>(std::strtoul(argv[++arg], nullptr, 0), 1, PATTERN_MAX_SIZE);
+        } else if (const std::string old = argv[arg + 1]; opt == "-old" && old.rfind(':') != std::string::npos) {
+            const auto colon = old.rfind(':');
+            dumps.push_back({ { old.substr(0, colon) }, std::strtoull(old.c_str() + colon + 1, nullptr, 0) });
+            arg++;
+        } else {
+            argc = 0;
+        }
+    }
+
+    if (argc - arg < 5) {
+        std::fprintf(stderr, "usage: %s [-name n] [-max size] [-old <nso>:<addr>]... <nso> <addr> <cond> <patch> <applied> [patch_offset]\n", argv[0]);
+        return 1;
+    }
+
+    dumps[0].nso.path = argv[arg];
+    dumps[0].addr = std::strtoull(argv[arg + 1], nullptr, 0);
+    const auto cond = parse_name(argv[arg + 2], COND_NAMES, std::size(COND_NAMES));
+    const auto patch = parse_name(argv[arg + 3], PATCH_NAMES, std::size(PATCH_NAMES));
+    const auto applied = parse_name(argv[arg + 4], APPLIED_NAMES, std::size(APPLIED_NAMES));
+    const s32 patch_offset = argc - arg > 5 ? std::strtol(argv[arg + 5], nullptr, 0) : 0;
+    if (cond < 0 || patch < 0 || applied < 0) {
+        std::fprintf(stderr, "unknown cond / patch / applied, see COND_NAMES etc in common/inst.hpp\n");
+        return 1;
+    }
+
+    std::vector<NsoImage> nsos;
+    for (auto& dump : dumps) {
+        nsos.push_back({ dump.nso.path });
+    }
+    nso_load_all(nsos);
+    for (u32 i = 0; i < dumps.size(); i++) {
+        auto& dump = dumps[i];
+        dump.nso = std::move(nsos[i]);
+        if (!dump.nso.ok()) {
+            std::fprintf(stderr, "%s: %s\n", dump.nso.path.c_str(), dump.nso.error.c_str());
+            return 1;
+        }
+        const auto& text = dump.nso.header.text;
+        if (dump.addr < text.memory_offset || dump.addr + 4 > (u64)text.memory_offset + text.size) {
+            std::fprintf(stderr, "%s: 0x%llx isn't in text\n", dump.nso.path.c_str(), (unsigned long long)dump.addr);
+            return 1;
+        }
+        dump.addr -= text.memory_offset;
+    }
+
+    const auto& target = dumps[0];
+    const auto text = target.text();
+    u32 inst{};
+    std::memcpy(&inst, text.data() + target.addr, sizeof(inst));
+    if (!INST_CONDS[cond].matches(inst) && !INST_APPLIED[applied].matches(inst)) {
+        std::fprintf(stderr, "warning: %08x doesn't match %s or %s\n", inst, COND_NAMES[cond], APPLIED_NAMES[applied]);
+    }
+
+    const auto sa_start = std::chrono::steady_clock::now();
+    parallel_for(dumps.size(), [&](size_t i) {
+        dumps[i].sa.build(dumps[i].text());
+    });
+    const auto sa_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sa_start).count();
+
+    // the area that patterns are taken from, +/- max_size around the instruction
+    const auto area_start = target.addr - std::min<u64>(target.addr, max_size);
+    const auto area_end = std::min<u64>(text.size(), target.addr + 4 + max_size);
+    const u32 area_size = area_end - area_start;
+    std::vector<u8> value(text.begin() + area_start, text.begin() + area_end);
+    std::vector<u8> mask(area_size, 0xFF);
+
+    // instructions are aligned, so the area is walked by instruction from the target
+    for (u64 pos = target.addr % 4; pos + 4 <= text.size() && pos < area_end; pos += 4) {
+        if (pos + 4 <= area_start) {
+            continue;
+        }
+        u32 cur{}, prev{};
+        std::memcpy(&cur, text.data() + pos, 4);
+        if (pos >= 4) {
+            std::memcpy(&prev, text.data() + pos - 4, 4);
+        }
+        const auto m = reloc_mask(cur, prev);
+        for (u32 b = 0; b < 4; b++) {
+            if (pos + b >= area_start && pos + b < area_end) {
+                mask[pos + b - area_start] &= m >> (b * 8);
+            }
+        }
+    }
+
+    // the bits that differ in the older dumps, or that they don't have at all
+    for (u32 d = 1; d < dumps.size(); d++) {
+        const auto old = dumps[d].text();
+        for (u32 i = 0; i < area_size; i++) {
+            const s64 pos = (s64)dumps[d].addr - (s64)(target.addr - area_start) + i;
+            mask[i] &= pos >= 0 && pos < (s64)old.size() ? ~(value[i] ^ old[pos]) : 0;
+        }
+    }
+    for (u32 i = 0; i < area_size; i++) {
+        value[i] &= mask[i];
+    }
+
+    // shortest first, then the fewest places the anchor is found in (the cost on the
+    // device), then the closest to the instruction
+    Candidate best{};
+    const u64 inst_index = target.addr - area_start;
+    for (u32 size = 1; size <= max_size && !best.size; size++) {
+        for (u32 start = 0; start + size <= area_size; start++) {
+            Candidate c{ start, size };
+            c.distance = start + size <= inst_index ? inst_index - start - size : start > inst_index + 4 ? start - inst_index - 4 : 0;
+            for (u32 i = 0, run = 0; i < size; i++) {
+                run = mask[start + i] == 0xFF ? run + 1 : 0;
+                if (run > c.anchor_size) {
+                    c.anchor_offset = i + 1 - run;
+                    c.anchor_size = run;
+                }
+            }
+            if (!c.anchor_size) {
+                continue;
+            }
+
+            const auto v = value.data() + start;
+            const auto m = mask.data() + start;
+            const auto [lo, hi] = target.sa.find(v + c.anchor_offset, c.anchor_size);
+            c.anchor_count = hi - lo;
+            if (best.size && (c.anchor_count > best.anchor_count || (c.anchor_count == best.anchor_count && c.distance >= best.distance))) {
+                continue;
+            }
+
+            bool unique = true;
+            for (u32 d = 0; d < dumps.size() && unique; d++) {
+                const auto pos = (s64)dumps[d].addr - (s64)inst_index + start;
+                unique = pos >= 0 && matches(dumps[d].text(), pos, v, m, size) && count_matches(dumps[d], v, m, c) == 1;
+            }
+            if (unique) {
+                best = c;
+            }
+        }
+    }
+
+    if (!best.size) {
+        std::fprintf(stderr, "no pattern of up to 0x%x bytes is unique, try a larger -max\n", max_size);
+        return 1;
+    }
+
+    const auto pat = pattern_str(value.data() + best.start, mask.data() + best.start, best.size);
+    const s32 inst_offset = (s64)inst_index - (s64)best.start;
+
+    // parse it back, so that what's printed is known to work
+    std::vector<u8> parsed(PATTERN_MAX_SIZE * 2);
+    const auto info = pattern_parse(pat.c_str(), parsed.data());
+    const PatternData data{ parsed.data(), info };
+    if (!info.ok || !data.matches(text.data() + area_start + best.start)) {
+        std::fprintf(stderr, "internal error: %s doesn't parse back\n", pat.c_str());
+        return 1;
+    }
+
+    std::fprintf(stderr, "suffix arrays built in %.3fms, 0x%x bytes, anchor of %u bytes found %u times in %s\n",
+        sa_ms, best.size, best.anchor_size, best.anchor_count, target.nso.path.c_str());
+    std::printf("    { \"%s\", \"%s\"_pat, %d, %d, CondId::%s, PatchId::%s, AppliedId::%s },\n",
+        name.c_str(), pat.c_str(), inst_offset, patch_offset, upper(COND_NAMES[cond]).c_str(), upper(PATCH_NAMES[patch]).c_str(), upper(APPLIED_NAMES[applied]).c_str());
+    std::printf("%s %s %d %d %s %s %s\n", name.c_str(), pat.c_str(), inst_offset, patch_offset, COND_NAMES[cond], PATCH_NAMES[patch], APPLIED_NAMES[applied]);
+    return 0;
+}
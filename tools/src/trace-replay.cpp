@@ -0,0 +1,336 @@
+// replays a trace captured on a console (see common/trace.hpp) through the sysmod's scanner,
+// so that a change to the scanner can be benchmarked against a real scan on a pc.
+// usage: trace-replay [-buffer size] [-first | -match-all] [-latency percent] [-runs n] <patterns.bin> <trace.bin>
+//  the memory the console read is rebuilt from the trace, and the svcs take as long as
+//  they did on the console (on average, scaled by -latency, default 100).
+//  -buffer sets the read size (default, the sysmod's), -first / -match-all the mode
+//  (default, the captured one) and -runs how many times each title is replayed, the
+//  fastest is printed.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "host_scan.hpp"
+#include "trace.hpp"
+
+namespace {
+
+struct ReplayRegion {
+    u64 addr;
+    u64 size;
+    ScanCode code;
+    std::vector<u8> data; // only for regions that were read
+    std::vector<bool> known; // bytes that the capture has
+};
+
+struct ReplayChunk {
+    u64 addr;
+    std::vector<u8> data;
+};
+
+struct ReplayTitle {
+    u64 title_id;
+    std::vector<ReplayRegion> regions; // every region queried, sorted by address
+    std::vector<ReplayChunk> reads; // in the order they were made
+    ScanStats device{}; // what the console did
+    u64 device_ticks{}; // from attaching to detaching
+};
+
+// the region that contains addr, nullptr if it wasn't queried
+auto find_region(std::vector<ReplayRegion>& regions, u64 addr) -> ReplayRegion* {
+    const auto it = std::upper_bound(regions.begin(), regions.end(), addr, [](u64 a, const ReplayRegion& r) { return a < r.addr; });
+    if (it == regions.begin() || addr - (it - 1)->addr >= (it - 1)->size) {
+        return nullptr;
+    }
+    return &*(it - 1);
+}
+
+// the average cost of each svc, from the capture, in ns
+struct LatencyModel {
+    double query{};
+    double write{};
+    double read_base{}; // a read takes read_base + read_per_byte * size
+    double read_per_byte{};
+
+    auto read(u64 size) const -> double {
+        return std::max(0.0, read_base + read_per_byte * size);
+    }
+};
+
+struct ReplayTarget {
+    ReplayTitle& title;
+    const LatencyModel& model;
+    double scale;
+    std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+    double svc_ns{}; // simulated
+    u32 misses{}; // reads of memory that the capture doesn't have
+
+    auto query(u64 addr, ScanRegion& out) -> bool {
+        svc_ns += model.query * scale;
+        const auto region = find_region(title.regions, addr);
+        if (!region) {
+            return false;
+        }
+        out = { region->addr, region->size, region->code };
+        return true;
+    }
+
+    auto read(void* out, u64 addr, u64 size) -> bool {
+        svc_ns += model.read(size) * scale;
+        const auto region = find_region(title.regions, addr);
+        if (!region || region->data.empty() || addr - region->addr + size > region->size) {
+            misses++;
+            return false;
+        }
+
+        const auto offset = addr - region->addr;
+        if (std::find(region->known.begin() + offset, region->known.begin() + offset + size, false) != region->known.begin() + offset + size) {
+            misses++;
+            return false;
+        }
+        std::memcpy(out, region->data.data() + offset, size);
+        return true;
+    }
+
+    auto write(const void* data, u64 addr, u64 size) -> bool {
+        svc_ns += model.write * scale;
+        const auto region = find_region(title.regions, addr);
+        if (!region || region->data.empty() || addr - region->addr + size > region->size) {
+            return false;
+        }
+        std::memcpy(region->data.data() + (addr - region->addr), data, size);
+        return true;
+    }
+
+    auto ticks() -> u64 {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() + (u64)svc_ns;
+    }
+};
+
+// the first read of a byte is kept, later ones could have been patched by then
+void fill_regions(ReplayTitle& title) {
+    std::sort(title.regions.begin(), title.regions.end(), [](const auto& a, const auto& b) { return a.addr < b.addr; });
+    title.regions.erase(std::unique(title.regions.begin(), title.regions.end(), [](const auto& a, const auto& b) { return a.addr == b.addr; }), title.regions.end());
+
+    // a module's name is read from its rodata, which isn't code
+    for (const auto& chunk : title.reads) {
+        const auto region = find_region(title.regions, chunk.addr);
+        if (!region) {
+            continue;
+        }
+        if (region->data.empty()) {
+            region->data.resize(region->size);
+            region->known.resize(region->size);
+        }
+        const auto offset = chunk.addr - region->addr;
+        for (u64 i = 0; i < chunk.data.size() && offset + i < region->size; i++) {
+            if (!region->known[offset + i]) {
+                region->data[offset + i] = chunk.data[i];
+                region->known[offset + i] = true;
+            }
+        }
+    }
+    title.reads = {};
+}
+
+auto load_trace(const std::vector<u8>& data, const TraceHeader* header, std::vector<ReplayTitle>& titles, LatencyModel& model) -> bool {
+    const auto to_ns = [&](u64 ticks) {
+        return ticks * 1e9 / header->tick_frequency;
+    };
+
+    // least squares for the reads, averages for the rest
+    double read_n{}, read_x{}, read_y{}, read_xx{}, read_xy{};
+    double query_n{}, query_sum{}, write_n{}, write_sum{};
+
+    ReplayTitle* title{};
+    u64 offset = header->header_size;
+    while (offset + header->event_size <= data.size()) {
+        TraceEvent event;
+        std::memcpy(&event, data.data() + offset, sizeof(event));
+        offset += header->event_size;
+
+        const auto has_data = event.ok && (event.type == TraceEventType::READ || event.type == TraceEventType::WRITE);
+        if (has_data && event.size > data.size() - offset) {
+            std::fprintf(stderr, "warning: the trace was cut short\n");
+            break;
+        }
+        const auto payload = data.data() + offset;
+        if (has_data) {
+            offset += event.size;
+        }
+
+        if (event.type == TraceEventType::ATTACH) {
+            titles.push_back({ event.addr });
+            title = &titles.back();
+            continue;
+        }
+        if (!title) {
+            return false;
+        }
+
+        const auto ns = to_ns(event.ticks);
+        switch (event.type) {
+            case TraceEventType::QUERY:
+                title->device.queries++;
+                title->regions.push_back({ event.addr, event.size, (ScanCode)event.code });
+                title->device.regions += event.code == ScanCode_Static;
+                query_n++;
+                query_sum += ns;
+                break;
+            case TraceEventType::READ:
+                title->device.reads++;
+                if (event.ok) {
+                    title->device.bytes_read += event.size;
+                    title->reads.push_back({ event.addr, { payload, payload + event.size } });
+                }
+                read_n++;
+                read_x += event.size;
+                read_y += ns;
+                read_xx += (double)event.size * event.size;
+                read_xy += event.size * ns;
+                break;
+            case TraceEventType::WRITE:
+                write_n++;
+                write_sum += ns;
+                break;
+            case TraceEventType::DETACH:
+                title->device_ticks = event.ticks;
+                fill_regions(*title);
+                title = nullptr;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (title) {
+        fill_regions(*title);
+    }
+
+    model.query = query_n ? query_sum / query_n : 0;
+    model.write = write_n ? write_sum / write_n : 0;
+    if (read_n) {
+        const auto denom = read_n * read_xx - read_x * read_x;
+        model.read_per_byte = denom ? (read_n * read_xy - read_x * read_y) / denom : 0;
+        model.read_base = (read_y - model.read_per_byte * read_x) / read_n;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    u64 buffer_size{};
+    int match_all = -1;
+    u32 latency = 100;
+    u32 runs = 1;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const std::string opt = argv[arg];
+        if (opt == "-first" || opt == "-match-all") {
+            match_all = opt == "-match-all";
+        } else if (arg + 1 < argc && opt == "-buffer") {
+            buffer_size = std::strtoull(argv[++arg], nullptr, 0);
+        } else if (arg + 1 < argc && opt == "-latency") {
+            latency = std::strtoul(argv[++arg], nullptr, 10);
+        } else if (arg + 1 < argc && opt == "-runs") {
+            runs = std::max(1UL, std::strtoul(argv[++arg], nullptr, 10));
+        } else {
+            argc = 0;
+        }
+    }
+
+    if (argc - arg < 2) {
+        std::fprintf(stderr, "usage: %s [-buffer size] [-first | -match-all] [-latency percent] [-runs n] <patterns.bin> <trace.bin>\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<u8> db, data;
+    std::vector<HostTitle> db_titles;
+    if (!host_read_file(argv[arg], db) || !host_read_file(argv[arg + 1], data)) {
+        std::perror(db.empty() ? argv[arg] : argv[arg + 1]);
+        return 1;
+    }
+    if (!host_load_pattern_db(db, db_titles)) {
+        std::fprintf(stderr, "%s: not a pattern database (or unsupported version)\n", argv[arg]);
+        return 1;
+    }
+
+    const auto header = trace_validate(data.data(), data.size());
+    std::vector<ReplayTitle> titles;
+    LatencyModel model{};
+    if (!header || !load_trace(data, header, titles, model)) {
+        std::fprintf(stderr, "%s: not a trace (or unsupported version)\n", argv[arg + 1]);
+        return 1;
+    }
+
+    if (!buffer_size) {
+        buffer_size = header->read_buffer_size;
+    }
+    if (match_all < 0) {
+        match_all = header->match_all;
+    }
+    inst_init(header->fw_version);
+
+    std::printf("captured by %.*s, fw %u.%u.%u, %s, read buffer 0x%x\n", (int)sizeof(header->syspatch_version), header->syspatch_version,
+        (header->fw_version >> 16) & 0xFF, (header->fw_version >> 8) & 0xFF, header->fw_version & 0xFF,
+        header->pattern_db ? "pattern database" : "built-in patterns", header->read_buffer_size);
+    std::printf("svc latency: query %.0fns, read %.0fns + %.3fns/byte, write %.0fns\n", model.query, model.read_base, model.read_per_byte, model.write);
+    std::printf("replaying with a read buffer of 0x%llx, %s, latency %u%%\n\n", (unsigned long long)buffer_size, match_all ? "match all" : "first match", latency);
+
+    const auto scanner = std::make_unique<Scanner>();
+    std::vector<u8> buffer(buffer_size);
+    std::vector<u8> window_buffer(WINDOW_BUFFER_SIZE);
+    scanner->window_buffer = window_buffer.data();
+
+    for (auto& title : titles) {
+        const auto db_title = std::find_if(db_titles.begin(), db_titles.end(), [&](const auto& t) { return t.title_id == title.title_id; });
+        if (db_title == db_titles.end()) {
+            std::printf("%016llx: not in the pattern database\n", (unsigned long long)title.title_id);
+            continue;
+        }
+
+        // each run starts from the captured memory, as the scan patches its copy
+        const auto regions = title.regions;
+        std::vector<PatternResult> results;
+        ScanStats stats{};
+        u64 best_ns = UINT64_MAX;
+        double best_svc_ns{};
+        u32 misses{};
+        for (u32 run = 0; run < runs; run++) {
+            title.regions = regions;
+            results.assign(db_title->patterns.size(), {});
+            stats = {};
+            host_skip_versions(db_title->patterns, results, header->fw_version);
+
+            ReplayTarget target{ title, model, latency / 100.0 };
+            if (scanner_init(*scanner, db_title->patterns, results, match_all)) {
+                scanner_scan_regions(*scanner, target, stats, buffer.data(), buffer.size(), UINT64_MAX);
+            }
+            if (const auto ns = target.ticks(); ns < best_ns) {
+                best_ns = ns;
+                best_svc_ns = target.svc_ns;
+            }
+            misses = target.misses;
+        }
+
+        std::printf("%s (%016llx)\n", db_title->name.c_str(), (unsigned long long)title.title_id);
+        std::printf("  console: %u queries, %u regions, %u reads, %llu bytes, %.3fms\n", title.device.queries, title.device.regions, title.device.reads,
+            (unsigned long long)title.device.bytes_read, title.device_ticks * 1e3 / header->tick_frequency);
+        std::printf("  replay:  %u queries, %u regions, %u reads, %llu bytes, %.3fms (svcs %.3fms, scanning %.3fms)\n", stats.queries, stats.regions, stats.reads,
+            (unsigned long long)stats.bytes_read, best_ns / 1e6, best_svc_ns / 1e6, (best_ns - best_svc_ns) / 1e6);
+        if (misses) {
+            std::printf("  warning: %u reads were of memory that wasn't captured\n", misses);
+        }
+        for (u32 i = 0; i < results.size(); i++) {
+            std::printf("  %-24s %-36s addr=%010llx matches=%u\n", db_title->patterns[i].patch_name,
+                patch_result_to_str(results[i].result), (unsigned long long)results[i].addr, results[i].match_count);
+        }
+    }
+
+    return 0;
+}